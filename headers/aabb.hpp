@@ -0,0 +1,164 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <limits>
+
+#include "ray.hpp"
+
+
+// Per-ray data for the slab test, computed once and shared by every box test
+struct InverseRay {
+    vector inv_direction;
+    vector scaled_origin;   // origin * inv_direction
+    int negative[3];
+
+    InverseRay(const Ray &ray) {
+        point origin = ray.getOrigin();
+        vector direction = ray.getDirection();
+
+        for (int axis = 0; axis < 3; axis++) {
+            // Keeps the inverse finite, so the slab test never sees inf - inf.
+            // The clamp must stay tiny: a ray aimed exactly at an edge shared by
+            // two boxes is otherwise nudged out of both of them.
+            double d = direction[axis];
+            if (std::fabs(d) < 1e-30) d = std::copysign(1e-30, d);
+
+            inv_direction[axis] = 1.0 / d;
+            negative[axis] = inv_direction[axis] < 0.0;
+        }
+
+        scaled_origin = origin * inv_direction;
+    }
+};
+
+
+class AABB {
+private:
+    point m_min;
+    point m_max;
+
+public:
+    // An empty box, which is the identity for the union of boxes
+    AABB() {
+        double inf = std::numeric_limits<double>::infinity();
+
+        m_min = point(inf, inf, inf);
+        m_max = point(-inf, -inf, -inf);
+    }
+
+    AABB(const point &t_a, const point &t_b) {
+        m_min = point(
+            std::fmin(t_a[0], t_b[0]),
+            std::fmin(t_a[1], t_b[1]),
+            std::fmin(t_a[2], t_b[2]));
+
+        m_max = point(
+            std::fmax(t_a[0], t_b[0]),
+            std::fmax(t_a[1], t_b[1]),
+            std::fmax(t_a[2], t_b[2]));
+    }
+
+    AABB(const AABB &t_a, const AABB &t_b) : AABB(t_a) {
+        expand(t_b);
+    }
+
+    static AABB infinite() {
+        double inf = std::numeric_limits<double>::infinity();
+
+        return AABB(point(-inf, -inf, -inf), point(inf, inf, inf));
+    }
+
+    point getMin() const { return m_min; }
+
+    point getMax() const { return m_max; }
+
+    void expand(const point &t_point) {
+        for (int axis = 0; axis < 3; axis++) {
+            m_min[axis] = (t_point[axis] < m_min[axis]) ? t_point[axis] : m_min[axis];
+            m_max[axis] = (t_point[axis] > m_max[axis]) ? t_point[axis] : m_max[axis];
+        }
+    }
+
+    void expand(const AABB &t_box) {
+        for (int axis = 0; axis < 3; axis++) {
+            m_min[axis] = (t_box.m_min[axis] < m_min[axis]) ? t_box.m_min[axis] : m_min[axis];
+            m_max[axis] = (t_box.m_max[axis] > m_max[axis]) ? t_box.m_max[axis] : m_max[axis];
+        }
+    }
+
+    // Grows degenerate (flat) dimensions so the slab test stays robust
+    AABB padded(double delta) const {
+        AABB box = *this;
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (box.m_max[axis] - box.m_min[axis] < delta) {
+                box.m_min[axis] -= 0.5 * delta;
+                box.m_max[axis] += 0.5 * delta;
+            }
+        }
+
+        return box;
+    }
+
+    bool isEmpty() const {
+        return m_min[0] > m_max[0] || m_min[1] > m_max[1] || m_min[2] > m_max[2];
+    }
+
+    bool isFinite() const {
+        return
+            std::isfinite(m_min[0]) && std::isfinite(m_min[1]) && std::isfinite(m_min[2]) &&
+            std::isfinite(m_max[0]) && std::isfinite(m_max[1]) && std::isfinite(m_max[2]);
+    }
+
+    point centroid() const { return 0.5 * (m_min + m_max); }
+
+    vector extent() const { return m_max - m_min; }
+
+    double surfaceArea() const {
+        if (isEmpty()) return 0.0;
+
+        vector d = extent();
+        return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+
+    int longestAxis() const {
+        vector d = extent();
+
+        if (d[0] > d[1] && d[0] > d[2]) return 0;
+        return (d[1] > d[2]) ? 1 : 2;
+    }
+
+    // Branchless slab test against [0.001, t_max]. Every lane does the same
+    // work, so the compiler can keep the three axes in vector registers.
+    bool hit(const InverseRay &ray, double t_max, double &t_enter) const {
+        double enter = 0.001;
+        double exit = t_max;
+
+        for (int axis = 0; axis < 3; axis++) {
+            double t0 = m_min[axis] * ray.inv_direction[axis] - ray.scaled_origin[axis];
+            double t1 = m_max[axis] * ray.inv_direction[axis] - ray.scaled_origin[axis];
+
+            double near = (t0 < t1) ? t0 : t1;
+            double far = (t0 < t1) ? t1 : t0;
+
+            enter = (near > enter) ? near : enter;
+            exit = (far < exit) ? far : exit;
+        }
+
+        t_enter = enter;
+        return enter <= exit;
+    }
+
+    bool hit(const InverseRay &ray, double t_max) const {
+        double t_enter;
+        return hit(ray, t_max, t_enter);
+    }
+
+    bool hit(const Ray &ray, double t_max) const {
+        return hit(InverseRay(ray), t_max);
+    }
+
+    ~AABB() = default;
+};
+
+#endif
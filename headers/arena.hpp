@@ -0,0 +1,102 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Owns the textures, materials and primitives of a scene. Objects are placed
+// one after the other in large blocks, in the order they are created, and
+// handed out as plain pointers that stay valid until the arena goes. Nothing
+// is freed on its own: the destructors that do something run, newest first,
+// and the blocks are released together.
+class Arena {
+private:
+    struct Destructor {
+        void (*destroy)(void *);
+        void * object;
+    };
+
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    std::vector<Destructor> m_destructors;
+
+    char * m_cursor = nullptr;
+    size_t m_space = 0;
+
+    size_t m_block_size;
+    size_t m_used = 0;
+    size_t m_reserved = 0;
+
+    void * allocate(size_t size, size_t alignment) {
+        void * pointer = m_cursor;
+
+        if (!std::align(alignment, size, pointer, m_space)) {
+            // Objects larger than a block get a block of their own
+            size_t block_size = std::max(m_block_size, size + alignment);
+
+            m_blocks.emplace_back(new char[block_size]);
+            m_reserved += block_size;
+
+            pointer = m_blocks.back().get();
+            m_space = block_size;
+
+            std::align(alignment, size, pointer, m_space);
+        }
+
+        m_cursor = static_cast<char *>(pointer) + size;
+        m_space -= size;
+        m_used += size;
+
+        return pointer;
+    }
+
+public:
+    Arena(size_t t_block_size = 1 << 16) {
+        m_block_size = t_block_size;
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template <typename T, typename... Args>
+    T * create(Args &&... t_args) {
+        T * object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(t_args)...);
+
+        if (!std::is_trivially_destructible<T>::value)
+            m_destructors.push_back({ [](void * p) { static_cast<T *>(p)->~T(); }, object });
+
+        return object;
+    }
+
+    // Bytes taken by objects, and by the blocks holding them
+    size_t getUsedBytes() const { return m_used; }
+
+    size_t getReservedBytes() const { return m_reserved; }
+
+    int getBlockCount() const { return static_cast<int>(m_blocks.size()); }
+
+    // Destroys every object at once; pointers handed out before are dangling
+    void clear() {
+        for (auto destructor = m_destructors.rbegin(); destructor != m_destructors.rend(); ++destructor)
+            destructor->destroy(destructor->object);
+
+        m_destructors.clear();
+        m_blocks.clear();
+
+        m_cursor = nullptr;
+        m_space = 0;
+        m_used = 0;
+        m_reserved = 0;
+    }
+
+    ~Arena() {
+        clear();
+    }
+};
+
+#endif
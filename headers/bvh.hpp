@@ -0,0 +1,134 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <limits>
+#include <vector>
+
+#include "hittable.hpp"
+#include "bvh_tree.hpp"
+#include "wide_bvh.hpp"
+
+
+class BVH: public Hittable {
+private:
+    std::vector<const Hittable *> m_objects;
+
+    // Objects such as planes are kept out of the tree so they don't ruin the bounds
+    std::vector<const Hittable *> m_unbounded;
+
+    BVHTree m_tree;
+    WideBVHTree m_wide_tree;
+
+    // Width of the tree used for queries: 2 for the binary tree, 4 or 8
+    int m_width = 2;
+
+public:
+    BVH() {}
+
+    // A width of 0 picks the widest layout the CPU supports
+    BVH(const HittableList &t_list, BVHBuilder t_builder = BVHBuilder::Binned, int t_width = 0) {
+        build(t_list.getObjects(), t_builder, t_width);
+    }
+
+    BVH(const std::vector<const Hittable *> &t_objects, BVHBuilder t_builder = BVHBuilder::Binned, int t_width = 0) {
+        build(t_objects, t_builder, t_width);
+    }
+
+    void build(const std::vector<const Hittable *> &t_objects, BVHBuilder t_builder = BVHBuilder::Binned, int t_width = 0) {
+        std::vector<const Hittable *> bounded;
+        std::vector<AABB> bounds;
+
+        m_unbounded.clear();
+
+        for (const Hittable * object: t_objects) {
+            AABB box = object->boundingBox();
+
+            if (box.isFinite()) {
+                bounded.push_back(object);
+                bounds.push_back(box);
+
+            } else {
+                m_unbounded.push_back(object);
+            }
+        }
+
+        m_tree.build(bounds, t_builder);
+
+        m_objects.clear();
+        m_objects.reserve(bounded.size());
+
+        for (int index: m_tree.getIndices())
+            m_objects.push_back(bounded[index]);
+
+        if (t_width == 2) {
+            m_width = 2;
+
+        } else {
+            m_wide_tree.build(m_tree, t_width);
+            m_width = m_wide_tree.getWidth();
+        }
+    }
+
+    int getWidth() const { return m_width; }
+
+    int getNodeCount() const { return m_tree.getNodeCount(); }
+
+    double getBuildTime() const { return m_tree.getBuildTime(); }
+
+    AABB boundingBox() const override {
+        return m_unbounded.empty() ? m_tree.boundingBox() : AABB::infinite();
+    }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        HitInfo tmp_info;
+
+        double root = std::numeric_limits<double>::infinity();
+
+        auto intersect = [&](int position, double &t_max) {
+            if (!m_objects[position]->hit(ray, tmp_info) || tmp_info.root >= t_max)
+                return false;
+
+            t_max = root = tmp_info.root;
+            info = tmp_info;
+
+            return true;
+        };
+
+        bool hit = (m_width == 2) ?
+            m_tree.traverse(ray, root, intersect) :
+            m_wide_tree.traverse(ray, root, intersect);
+
+        // Tested last so that coplanar bounded surfaces win ties, as in HittableList
+        for (const Hittable * object: m_unbounded) {
+            if (object->hit(ray, tmp_info) && tmp_info.root < root) {
+                root = tmp_info.root;
+                info = tmp_info;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+
+    bool occluded(const Ray &ray, double t_max) const override {
+        auto intersect = [&](int position, double &t_max) {
+            return m_objects[position]->occluded(ray, t_max);
+        };
+
+        bool hit = (m_width == 2) ?
+            m_tree.occluded(ray, t_max, intersect) :
+            m_wide_tree.occluded(ray, t_max, intersect);
+
+        if (hit) return true;
+
+        for (const Hittable * object: m_unbounded) {
+            if (object->occluded(ray, t_max)) return true;
+        }
+
+        return false;
+    }
+
+    ~BVH() = default;
+};
+
+#endif
@@ -0,0 +1,673 @@
+#ifndef BVH_TREE_H
+#define BVH_TREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+#include <omp.h>
+
+#include "aabb.hpp"
+
+
+enum class BVHBuilder {
+    Sweep,    // Full sweep SAH over sorted centroids, serial
+    Binned,   // Binned SAH, with the upper splits run as parallel tasks
+    Linear    // Morton code LBVH, much faster to build but slower to traverse
+};
+
+
+struct BVHNode {
+    AABB bounds;
+    int offset;   // Leaf: first primitive, interior: index of the first child
+    int count;    // Number of primitives, zero for interior nodes
+    int axis;     // Split axis, used to visit the nearest child first
+};
+
+
+class BVHTree {
+private:
+    // Children are stored in adjacent pairs, so subtrees can be built concurrently
+    std::vector<BVHNode> m_nodes;
+    std::vector<int> m_indices;
+
+    double m_build_time = 0.0;
+
+    // Relative costs used by the surface area heuristic
+    static constexpr double traversal_cost = 0.125;
+    static constexpr double intersection_cost = 1.0;
+
+    static const int max_leaf_size = 4;
+    static const int max_depth = 60;
+
+    static const int bin_count = 16;
+
+    // Below this size a subtree is built by the task that reached it
+    static const int task_threshold = 4096;
+
+    // Above this size the binning pass itself is split across the threads
+    static const int parallel_binning_threshold = 65536;
+
+    // Primitive bounds travel with their index, so partitioning keeps them contiguous
+    struct PrimitiveRef {
+        AABB bounds;
+        int index;
+
+        double centroid(int axis) const {
+            return 0.5 * (bounds.getMin()[axis] + bounds.getMax()[axis]);
+        }
+    };
+
+    struct BuildState {
+        std::vector<PrimitiveRef> refs;
+        std::atomic<int> node_count;
+
+        BuildState(const std::vector<AABB> &t_bounds) : node_count(1) {
+            refs.resize(t_bounds.size());
+
+            for (int i = 0; i < static_cast<int>(t_bounds.size()); i++)
+                refs[i] = PrimitiveRef{ t_bounds[i], i };
+        }
+
+        int allocatePair() { return node_count.fetch_add(2); }
+    };
+
+    struct Bin {
+        AABB bounds;
+        AABB centroid_bounds;
+        int count = 0;
+
+        void merge(const Bin &t_bin) {
+            bounds.expand(t_bin.bounds);
+            centroid_bounds.expand(t_bin.centroid_bounds);
+            count += t_bin.count;
+        }
+    };
+
+    void makeLeaf(int node_index, int begin, int end) {
+        m_nodes[node_index].offset = begin;
+        m_nodes[node_index].count = end - begin;
+        m_nodes[node_index].axis = 0;
+    }
+
+    void makeInterior(int node_index, int first_child, int axis) {
+        m_nodes[node_index].offset = first_child;
+        m_nodes[node_index].count = 0;
+        m_nodes[node_index].axis = axis;
+    }
+
+    static void computeBounds(const BuildState &state, int begin, int end, AABB &box, AABB &centroid_box) {
+        for (int i = begin; i < end; i++) {
+            box.expand(state.refs[i].bounds);
+            centroid_box.expand(state.refs[i].bounds.centroid());
+        }
+    }
+
+    static void sortByAxis(BuildState &state, int begin, int end, int axis) {
+        std::sort(
+            state.refs.begin() + begin, state.refs.begin() + end,
+            [&](const PrimitiveRef &a, const PrimitiveRef &b) {
+                return a.centroid(axis) < b.centroid(axis); });
+    }
+
+    // Bins all three axes in a single pass; bins[axis * bin_count + bin]
+    static void binRange(
+        const BuildState &state, int begin, int end,
+        const point &centroid_min, const double scale[3], Bin *bins) {
+
+        for (int i = begin; i < end; i++) {
+            const AABB &bounds = state.refs[i].bounds;
+            point centroid = bounds.centroid();
+
+            for (int axis = 0; axis < 3; axis++) {
+                int bin = static_cast<int>((centroid[axis] - centroid_min[axis]) * scale[axis]);
+                Bin &target = bins[axis * bin_count + bin];
+
+                target.count++;
+                target.bounds.expand(bounds);
+                target.centroid_bounds.expand(centroid);
+            }
+        }
+    }
+
+    // Median split, for ranges whose centroids cannot be told apart by the SAH
+    static int splitMiddle(BuildState &state, int begin, int end, int axis) {
+        int mid = begin + (end - begin) / 2;
+
+        std::nth_element(
+            state.refs.begin() + begin, state.refs.begin() + mid, state.refs.begin() + end,
+            [&](const PrimitiveRef &a, const PrimitiveRef &b) {
+                return a.centroid(axis) < b.centroid(axis); });
+
+        return mid;
+    }
+
+    void buildSweep(BuildState &state, int node_index, int begin, int end, int depth) {
+        AABB box;
+        AABB centroid_box;
+        computeBounds(state, begin, end, box, centroid_box);
+
+        m_nodes[node_index].bounds = box;
+
+        int count = end - begin;
+        if (count <= 1 || depth >= max_depth)
+            return makeLeaf(node_index, begin, end);
+
+        // Full sweep over the sorted centroids on every axis
+        double leaf_cost = intersection_cost * count;
+        double best_cost = std::numeric_limits<double>::infinity();
+        int best_axis = -1;
+        int best_split = -1;
+
+        double inv_area = 1.0 / std::fmax(box.surfaceArea(), 1e-12);
+        std::vector<double> right_area(count);
+        int sorted_axis = -1;
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroid_box.extent()[axis] <= 0.0) continue;
+
+            sortByAxis(state, begin, end, axis);
+            sorted_axis = axis;
+
+            AABB right;
+            for (int i = count - 1; i > 0; i--) {
+                right.expand(state.refs[begin + i].bounds);
+                right_area[i] = right.surfaceArea();
+            }
+
+            AABB left;
+            for (int i = 1; i < count; i++) {
+                left.expand(state.refs[begin + i - 1].bounds);
+
+                double cost = traversal_cost + intersection_cost * inv_area *
+                    (left.surfaceArea() * i + right_area[i] * (count - i));
+
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i;
+                }
+            }
+        }
+
+        int mid;
+
+        if (best_axis == -1) {
+            // Every centroid coincides, so no split can separate them
+            if (count <= max_leaf_size)
+                return makeLeaf(node_index, begin, end);
+
+            best_axis = 0;
+            mid = splitMiddle(state, begin, end, best_axis);
+
+        } else {
+            if (best_cost >= leaf_cost && count <= max_leaf_size)
+                return makeLeaf(node_index, begin, end);
+
+            if (best_axis != sorted_axis)
+                sortByAxis(state, begin, end, best_axis);
+
+            mid = begin + best_split;
+        }
+
+        int first_child = state.allocatePair();
+        makeInterior(node_index, first_child, best_axis);
+
+        buildSweep(state, first_child, begin, mid, depth + 1);
+        buildSweep(state, first_child + 1, mid, end, depth + 1);
+    }
+
+    // The node and centroid bounds come from the parent's bins, so each level
+    // reads the primitives once for binning and once for partitioning.
+    void buildBinned(
+        BuildState &state, int node_index, int begin, int end, int depth,
+        const AABB &box, const AABB &centroid_box) {
+
+        m_nodes[node_index].bounds = box;
+
+        int count = end - begin;
+        if (count <= 1 || depth >= max_depth)
+            return makeLeaf(node_index, begin, end);
+
+        point centroid_min = centroid_box.getMin();
+        vector centroid_extent = centroid_box.extent();
+
+        double scale[3];
+        for (int axis = 0; axis < 3; axis++) {
+            scale[axis] = (centroid_extent[axis] > 0.0) ?
+                bin_count * (1.0 - 1e-9) / centroid_extent[axis] : 0.0;
+        }
+
+        Bin bins[3 * bin_count];
+
+        if (count >= parallel_binning_threshold) {
+            int chunks = omp_get_num_threads();
+            std::vector<Bin> chunk_bins(chunks * 3 * bin_count);
+
+            #pragma omp taskloop default(shared) grainsize(1)
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                binRange(
+                    state,
+                    begin + static_cast<int>(static_cast<long>(count) * chunk / chunks),
+                    begin + static_cast<int>(static_cast<long>(count) * (chunk + 1) / chunks),
+                    centroid_min, scale, &chunk_bins[chunk * 3 * bin_count]);
+            }
+
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                for (int bin = 0; bin < 3 * bin_count; bin++)
+                    bins[bin].merge(chunk_bins[chunk * 3 * bin_count + bin]);
+            }
+
+        } else {
+            binRange(state, begin, end, centroid_min, scale, bins);
+        }
+
+        double leaf_cost = intersection_cost * count;
+        double best_cost = std::numeric_limits<double>::infinity();
+        int best_axis = -1;
+        int best_bin = -1;
+
+        double inv_area = 1.0 / std::fmax(box.surfaceArea(), 1e-12);
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (scale[axis] == 0.0) continue;
+
+            // Right-to-left sweep over the bin boundaries
+            double right_area[bin_count];
+            int right_count[bin_count];
+
+            AABB right;
+            int right_total = 0;
+
+            for (int bin = bin_count - 1; bin > 0; bin--) {
+                right.expand(bins[axis * bin_count + bin].bounds);
+                right_total += bins[axis * bin_count + bin].count;
+
+                right_area[bin] = right.surfaceArea();
+                right_count[bin] = right_total;
+            }
+
+            AABB left;
+            int left_total = 0;
+
+            for (int bin = 1; bin < bin_count; bin++) {
+                left.expand(bins[axis * bin_count + bin - 1].bounds);
+                left_total += bins[axis * bin_count + bin - 1].count;
+
+                if (left_total == 0 || right_count[bin] == 0) continue;
+
+                double cost = traversal_cost + intersection_cost * inv_area *
+                    (left.surfaceArea() * left_total + right_area[bin] * right_count[bin]);
+
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = bin;
+                }
+            }
+        }
+
+        int mid;
+
+        AABB left_box, left_centroids;
+        AABB right_box, right_centroids;
+
+        if (best_axis == -1) {
+            if (count <= max_leaf_size)
+                return makeLeaf(node_index, begin, end);
+
+            best_axis = centroid_box.longestAxis();
+            mid = splitMiddle(state, begin, end, best_axis);
+
+            computeBounds(state, begin, mid, left_box, left_centroids);
+            computeBounds(state, mid, end, right_box, right_centroids);
+
+        } else {
+            if (best_cost >= leaf_cost && count <= max_leaf_size)
+                return makeLeaf(node_index, begin, end);
+
+            double axis_min = centroid_min[best_axis];
+            double axis_scale = scale[best_axis];
+
+            auto middle = std::partition(
+                state.refs.begin() + begin, state.refs.begin() + end,
+                [&](const PrimitiveRef &ref) {
+                    int bin = static_cast<int>((ref.centroid(best_axis) - axis_min) * axis_scale);
+                    return bin < best_bin;
+                });
+
+            mid = static_cast<int>(middle - state.refs.begin());
+
+            for (int bin = 0; bin < bin_count; bin++) {
+                AABB &child_box = (bin < best_bin) ? left_box : right_box;
+                AABB &child_centroids = (bin < best_bin) ? left_centroids : right_centroids;
+
+                child_box.expand(bins[best_axis * bin_count + bin].bounds);
+                child_centroids.expand(bins[best_axis * bin_count + bin].centroid_bounds);
+            }
+        }
+
+        int first_child = state.allocatePair();
+        makeInterior(node_index, first_child, best_axis);
+
+        if (count >= task_threshold) {
+            #pragma omp task default(shared) firstprivate(first_child, begin, mid, depth, left_box, left_centroids)
+            buildBinned(state, first_child, begin, mid, depth + 1, left_box, left_centroids);
+
+            #pragma omp task default(shared) firstprivate(first_child, mid, end, depth, right_box, right_centroids)
+            buildBinned(state, first_child + 1, mid, end, depth + 1, right_box, right_centroids);
+
+        } else {
+            buildBinned(state, first_child, begin, mid, depth + 1, left_box, left_centroids);
+            buildBinned(state, first_child + 1, mid, end, depth + 1, right_box, right_centroids);
+        }
+    }
+
+    struct MortonRef {
+        unsigned int code;
+        int ref;
+    };
+
+    static const int morton_bits = 30;
+
+    // Spreads the low 10 bits of v so that two zero bits separate each of them
+    static unsigned int spreadBits(unsigned int v) {
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+
+        return v;
+    }
+
+    // LSD radix sort on 8-bit digits. Every thread histograms its own chunk,
+    // so the scatter is stable and needs no atomics.
+    static void radixSort(std::vector<MortonRef> &keys) {
+        int count = static_cast<int>(keys.size());
+        int max_threads = omp_get_num_procs();
+
+        std::vector<MortonRef> buffer(count);
+        std::vector<int> offsets(max_threads * 256);
+
+        for (int shift = 0; shift < morton_bits; shift += 8) {
+            #pragma omp parallel num_threads(max_threads)
+            {
+                int thread = omp_get_thread_num();
+                int threads = omp_get_num_threads();
+
+                int begin = static_cast<int>(static_cast<long>(count) * thread / threads);
+                int end = static_cast<int>(static_cast<long>(count) * (thread + 1) / threads);
+
+                int *histogram = &offsets[thread * 256];
+                std::fill(histogram, histogram + 256, 0);
+
+                for (int i = begin; i < end; i++)
+                    histogram[(keys[i].code >> shift) & 255]++;
+
+                #pragma omp barrier
+
+                #pragma omp single
+                {
+                    int total = 0;
+
+                    for (int digit = 0; digit < 256; digit++) {
+                        for (int t = 0; t < threads; t++) {
+                            int digit_count = offsets[t * 256 + digit];
+                            offsets[t * 256 + digit] = total;
+                            total += digit_count;
+                        }
+                    }
+                }
+
+                for (int i = begin; i < end; i++)
+                    buffer[histogram[(keys[i].code >> shift) & 255]++] = keys[i];
+            }
+
+            keys.swap(buffer);
+        }
+    }
+
+    // Sorts the primitive refs along a Z-order curve through their centroids
+    static std::vector<MortonRef> sortByMortonCode(BuildState &state) {
+        int count = static_cast<int>(state.refs.size());
+
+        AABB box;
+        AABB centroid_box;
+        computeBounds(state, 0, count, box, centroid_box);
+
+        point centroid_min = centroid_box.getMin();
+        vector centroid_extent = centroid_box.extent();
+
+        double scale[3];
+        for (int axis = 0; axis < 3; axis++)
+            scale[axis] = (centroid_extent[axis] > 0.0) ? 1023.0 / centroid_extent[axis] : 0.0;
+
+        std::vector<MortonRef> keys(count);
+
+        #pragma omp parallel for num_threads(omp_get_num_procs())
+        for (int i = 0; i < count; i++) {
+            point centroid = state.refs[i].bounds.centroid();
+            unsigned int code = 0;
+
+            for (int axis = 0; axis < 3; axis++) {
+                unsigned int q = static_cast<unsigned int>(
+                    (centroid[axis] - centroid_min[axis]) * scale[axis]);
+
+                code |= spreadBits(q) << (2 - axis);
+            }
+
+            keys[i] = MortonRef{ code, i };
+        }
+
+        radixSort(keys);
+
+        std::vector<PrimitiveRef> sorted(count);
+
+        #pragma omp parallel for num_threads(omp_get_num_procs())
+        for (int i = 0; i < count; i++)
+            sorted[i] = state.refs[keys[i].ref];
+
+        state.refs.swap(sorted);
+
+        return keys;
+    }
+
+    // Splits each range where its highest differing Morton bit flips, so no
+    // cost is evaluated; bounds are gathered on the way back up.
+    AABB buildLinear(
+        BuildState &state, const std::vector<MortonRef> &keys,
+        int node_index, int begin, int end, int bit, int depth) {
+
+        int count = end - begin;
+
+        // The codes in the range are sorted and share every bit above this one
+        while (bit >= 0 && ((keys[begin].code ^ keys[end - 1].code) >> bit & 1) == 0)
+            bit--;
+
+        if (count <= max_leaf_size || depth >= max_depth) {
+            AABB box;
+
+            for (int i = begin; i < end; i++)
+                box.expand(state.refs[i].bounds);
+
+            m_nodes[node_index].bounds = box;
+            makeLeaf(node_index, begin, end);
+
+            return box;
+        }
+
+        int mid;
+        int axis;
+
+        if (bit < 0) {
+            // Identical codes, so any split is as good as another
+            mid = begin + count / 2;
+            axis = 0;
+
+        } else {
+            auto first_set = std::partition_point(
+                keys.begin() + begin, keys.begin() + end,
+                [&](const MortonRef &key) { return ((key.code >> bit) & 1) == 0; });
+
+            mid = static_cast<int>(first_set - keys.begin());
+            axis = 2 - bit % 3;
+        }
+
+        int first_child = state.allocatePair();
+        makeInterior(node_index, first_child, axis);
+
+        AABB left_box;
+        AABB right_box;
+
+        if (count >= task_threshold) {
+            #pragma omp task default(shared) firstprivate(first_child, begin, mid, bit, depth)
+            left_box = buildLinear(state, keys, first_child, begin, mid, bit - 1, depth + 1);
+
+            #pragma omp task default(shared) firstprivate(first_child, mid, end, bit, depth)
+            right_box = buildLinear(state, keys, first_child + 1, mid, end, bit - 1, depth + 1);
+
+            #pragma omp taskwait
+
+        } else {
+            left_box = buildLinear(state, keys, first_child, begin, mid, bit - 1, depth + 1);
+            right_box = buildLinear(state, keys, first_child + 1, mid, end, bit - 1, depth + 1);
+        }
+
+        AABB box = AABB(left_box, right_box);
+        m_nodes[node_index].bounds = box;
+
+        return box;
+    }
+
+public:
+    BVHTree() {}
+
+    BVHTree(const std::vector<AABB> &t_bounds, BVHBuilder t_builder = BVHBuilder::Binned) {
+        build(t_bounds, t_builder);
+    }
+
+    void build(const std::vector<AABB> &t_bounds, BVHBuilder t_builder = BVHBuilder::Binned) {
+        auto start = std::chrono::steady_clock::now();
+
+        int count = static_cast<int>(t_bounds.size());
+
+        m_nodes.clear();
+        m_indices.clear();
+
+        if (count == 0) return;
+
+        BuildState state(t_bounds);
+
+        // Leaves hold at least one primitive, which bounds the node count
+        m_nodes.resize(2 * count - 1);
+
+        if (t_builder == BVHBuilder::Sweep) {
+            buildSweep(state, 0, 0, count, 0);
+
+        } else if (t_builder == BVHBuilder::Linear) {
+            std::vector<MortonRef> keys = sortByMortonCode(state);
+
+            #pragma omp parallel num_threads(omp_get_num_procs())
+            #pragma omp single nowait
+            buildLinear(state, keys, 0, 0, count, morton_bits - 1, 0);
+
+        } else {
+            AABB box;
+            AABB centroid_box;
+            computeBounds(state, 0, count, box, centroid_box);
+
+            // Same thread count as Camera::render
+            #pragma omp parallel num_threads(omp_get_num_procs())
+            #pragma omp single nowait
+            buildBinned(state, 0, 0, count, 0, box, centroid_box);
+        }
+
+        m_nodes.resize(state.node_count);
+
+        m_indices.resize(count);
+        for (int i = 0; i < count; i++)
+            m_indices[i] = state.refs[i].index;
+
+        m_build_time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Leaf order of the primitives; owners reorder their storage with it
+    const std::vector<int> &getIndices() const { return m_indices; }
+
+    const std::vector<BVHNode> &getNodes() const { return m_nodes; }
+
+    int getNodeCount() const { return static_cast<int>(m_nodes.size()); }
+
+    // Wall-clock seconds spent in the last build
+    double getBuildTime() const { return m_build_time; }
+
+    AABB boundingBox() const {
+        return m_nodes.empty() ? AABB() : m_nodes[0].bounds;
+    }
+
+    // Calls intersect(position, t_max) for every primitive in a visited leaf,
+    // where position is in leaf order. The callback shrinks t_max on a hit.
+    template <typename F>
+    bool traverse(const Ray &ray, double t_max, F &&intersect) const {
+        return walk<false>(ray, t_max, intersect);
+    }
+
+    // Same callback, but the first primitive it reports as hit ends the walk
+    template <typename F>
+    bool occluded(const Ray &ray, double t_max, F &&intersect) const {
+        return walk<true>(ray, t_max, intersect);
+    }
+
+private:
+    template <bool AnyHit, typename F>
+    bool walk(const Ray &ray, double t_max, F &intersect) const {
+        if (m_nodes.empty()) return false;
+
+        InverseRay inverse = InverseRay(ray);
+
+        int stack[max_depth + 4];
+        int top = 0;
+        int current = 0;
+
+        bool hit = false;
+
+        while (true) {
+            const BVHNode &node = m_nodes[current];
+
+            if (node.bounds.hit(inverse, t_max)) {
+                if (node.count > 0) {
+                    for (int i = 0; i < node.count; i++) {
+                        if (intersect(node.offset + i, t_max)) {
+                            if (AnyHit) return true;
+                            hit = true;
+                        }
+                    }
+
+                    if (top == 0) break;
+                    current = stack[--top];
+
+                } else {
+                    // Visit the child on the near side of the split first
+                    int near = inverse.negative[node.axis];
+
+                    stack[top++] = node.offset + 1 - near;
+                    current = node.offset + near;
+                }
+
+            } else {
+                if (top == 0) break;
+                current = stack[--top];
+            }
+        }
+
+        return hit;
+    }
+
+public:
+    ~BVHTree() = default;
+};
+
+#endif
@@ -1,12 +1,27 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "utils.hpp"
+#include "sampler.hpp"
+#include "tiles.hpp"
+#include "preview.hpp"
+#include "framebuffer.hpp"
 
-#include "hittable.hpp"
+#include "bvh.hpp"
 #include "material.hpp"
 #include <omp.h>
 
+// Set, from a signal handler for instance, to end a render early: it stops
+// as if its time were up, and writes its checkpoint and image
+inline std::atomic<bool> render_stop_requested(false);
+
+
 class Camera {
 private:
     int m_width;
@@ -21,12 +36,81 @@ private:
     vector m_viewport_v;
     vector m_viewport_anchor;
 
-    // Anti-aliasing sampling
+    // Anti-aliasing sampling, per pixel on average when sampling adaptively
     int aa_sampling = 500;
 
-    // Recursive ray scattering
+    // Adaptive sampling: a pixel stops once the error of its displayed value,
+    // on a scale of 0 to 1, falls below the threshold. The samples it saves go
+    // to noisier pixels, up to m_max_sample_scale times aa_sampling each.
+    // A threshold of zero gives every pixel aa_sampling samples.
+    double m_error_threshold = 0.0025;
+    int m_max_sample_scale = 4;
+
+    // Samples a pixel takes between two checks of its error, and at least.
+    // Fewer make the variance estimate too rough, and flat pixels stop early.
+    int m_batch_size = 64;
+
+    // Longest path, in scattering events
     int max_depth = 50;
 
+    // Paths may be ended at random from this bounce on
+    int m_roulette_depth = 5;
+
+    // Emitters sampled with shadow rays at every diffuse bounce
+    HittableList m_lights;
+
+    // Threads work through square tiles, each starting on a run of nearby
+    // tiles and stealing from the others once it is done
+    int m_tile_size = 32;
+    TileOrder m_tile_order = TileOrder::Hilbert;
+
+    // Time budget: with a budget, in seconds, the render ignores aa_sampling
+    // and samples until the time is up. Once every pixel is below the error
+    // threshold the threshold is halved, so the time goes on the pixels that
+    // are still the noisiest. Zero renders to the sample budget.
+    double m_time_budget = 0.0;
+    double m_render_time = 0.0;
+
+    // Estimates of the last render, or of the checkpoint to resume from
+    Framebuffer m_framebuffer;
+    bool m_resuming = false;
+
+    // Checkpoints: the framebuffer is saved to m_checkpoint_filename after a
+    // pass once m_checkpoint_interval seconds have gone by, and when the
+    // render ends
+    std::string m_checkpoint_filename;
+    double m_checkpoint_interval = 0.0;
+
+    // Progressive previews: the image so far is written to m_preview_filename
+    // once the first pass has given every pixel a sample, then after a pass
+    // once m_preview_interval seconds or m_preview_passes passes have gone by
+    // since the last one. Zero turns either trigger off. Past the first passes,
+    // which double the samples of each pixel, a pass gives each pixel
+    // m_batch_size samples, so that sets the step.
+    std::string m_preview_filename;
+    double m_preview_interval = 0.0;
+    int m_preview_passes = 0;
+    int m_preview_count = 0;
+
+    // Statistics of the last render
+    long long m_path_count = 0;
+    long long m_path_segments = 0;
+    std::vector<int> m_sample_counts;
+
+    // Seconds each thread spent rendering and waiting for the others
+    std::vector<double> m_busy_times;
+    std::vector<double> m_idle_times;
+    long long m_steal_count = 0;
+
+    // The image depends only on this seed, whatever the number of threads
+    uint64_t m_seed = 0;
+
+    // Cloned for each thread
+    std::shared_ptr<Sampler> m_sampler = std::make_shared<SobolSampler>();
+
+    // Zero uses one thread per processor
+    int m_threads = 0;
+
 public:
     Camera() {
         constructor(400, 225, vector(2.0, 0.0, 0.5), 0.004);
@@ -61,66 +145,485 @@ public:
         m_viewport_anchor -= 0.5 * (m_viewport_u + m_viewport_v);
     }
 
-    color rayColor(const Ray &ray, const HittableList &world, int depth) {
-        if (depth <= 0)
-            return color(0.0, 0.0, 0.0);
+    void setSeed(uint64_t t_seed) { m_seed = t_seed; }
+
+    void setThreads(int t_threads) { m_threads = t_threads; }
+
+    void setSampler(std::shared_ptr<Sampler> t_sampler) { m_sampler = t_sampler; }
+
+    void setSamples(int t_samples) { aa_sampling = t_samples; }
+
+    void setMaxDepth(int t_depth) { max_depth = t_depth; }
+
+    // A depth of max_depth or more disables Russian roulette
+    void setRouletteDepth(int t_depth) { m_roulette_depth = t_depth; }
+
+    // An empty list leaves all the light to the paths that hit emitters
+    void setLights(const HittableList &t_lights) { m_lights = t_lights; }
+
+    void setErrorThreshold(double t_threshold) { m_error_threshold = t_threshold; }
+
+    void setMaxSampleScale(int t_scale) { m_max_sample_scale = t_scale; }
+
+    void setBatchSize(int t_size) { m_batch_size = t_size; }
+
+    void setTileSize(int t_size) { m_tile_size = t_size; }
+
+    void setTileOrder(TileOrder t_order) { m_tile_order = t_order; }
+
+    // An empty filename turns previews off
+    void setPreview(const std::string &t_filename, double t_seconds, int t_passes = 0) {
+        m_preview_filename = t_filename;
+        m_preview_interval = t_seconds;
+        m_preview_passes = t_passes;
+    }
+
+    void setTimeBudget(double t_seconds) { m_time_budget = t_seconds; }
+
+    // Zero only saves the checkpoint at the end of the render
+    void setCheckpoint(const std::string &t_filename, double t_seconds) {
+        m_checkpoint_filename = t_filename;
+        m_checkpoint_interval = t_seconds;
+    }
+
+    // The next render goes on from the estimates saved in filename, with
+    // their seed, so that it ends as an uninterrupted render would. The
+    // sample budget counts the samples already taken.
+    bool resume(const std::string &filename) {
+        Framebuffer framebuffer;
+        if (!framebuffer.load(filename)) return false;
+
+        if (framebuffer.getWidth() != m_width || framebuffer.getHeight() != m_height) {
+            std::cerr << "ERROR: '" << filename << "' is " << framebuffer.getWidth() << "x"
+                      << framebuffer.getHeight() << ", not " << m_width << "x" << m_height << ".\n";
+            return false;
+        }
+
+        m_framebuffer = std::move(framebuffer);
+        m_seed = m_framebuffer.getSeed();
+        m_resuming = true;
+
+        return true;
+    }
+
+    const Framebuffer &getFramebuffer() const { return m_framebuffer; }
+
+    // Wall-clock seconds of the last render
+    double getRenderTime() const { return m_render_time; }
+
+    // Samples per pixel the last render reached, on average, counting those
+    // of the checkpoint it resumed from
+    double getAverageSamples() const {
+        int pixel_count = m_framebuffer.getPixelCount();
+        return (pixel_count > 0) ? static_cast<double>(m_framebuffer.getSampleCount()) / pixel_count : 0.0;
+    }
+
+    // Previews written during the last render
+    int getPreviewCount() const { return m_preview_count; }
+
+    // Samples taken by each pixel in the last render, row by row
+    const std::vector<int> &getSampleCounts() const { return m_sample_counts; }
+
+    const std::vector<double> &getBusyTimes() const { return m_busy_times; }
+
+    const std::vector<double> &getIdleTimes() const { return m_idle_times; }
+
+    // Tiles that threads took from the share of another in the last render
+    long long getStealCount() const { return m_steal_count; }
+
+    // Mean number of rays traced per camera sample in the last render
+    double getAveragePathLength() const {
+        return (m_path_count > 0) ? static_cast<double>(m_path_segments) / m_path_count : 0.0;
+    }
+
+    // Pdf of light sampling picking the ray towards the light it hit at root.
+    // Each light is a strategy of its own, chosen uniformly, so only the light
+    // that was hit counts; zero when it is not in the list.
+    double lightPdf(const Ray &ray, double root) const {
+        const std::vector<const Hittable *> &lights = m_lights.getObjects();
+
+        for (const Hittable * light: lights) {
+            HitInfo info;
+
+            if (light->hit(ray, info) && std::fabs(info.root - root) <= 1e-9 * root)
+                return light->directionPdf(ray.getOrigin(), ray.getDirection()) / lights.size();
+        }
+
+        return 0.0;
+    }
+
+    // Power heuristic of Veach, with an exponent of 2
+    static double misWeight(double pdf, double other_pdf) {
+        return (pdf * pdf) / (pdf * pdf + other_pdf * other_pdf);
+    }
+
+    // Follows one path, carrying its throughput instead of recursing. At
+    // diffuse bounces a shadow ray samples the lights as well, and multiple
+    // importance sampling weighs it against the scattered ray finding them.
+    // Segments counts the rays traced along the path.
+    color rayColor(const Ray &t_ray, const Hittable &world, Sampler &sampler, int &segments) {
+        color radiance = color(0.0, 0.0, 0.0);
+        color throughput = color(1.0, 1.0, 1.0);
+
+        const std::vector<const Hittable *> &lights = m_lights.getObjects();
+
+        Ray ray = t_ray;
+        segments = 0;
+
+        // Pdf of scatter having picked the ray, or zero when the lights were
+        // not sampled where it left from
+        double scattering_pdf = 0.0;
+
+        for (int depth = 0; depth < max_depth; depth++) {
+            HitInfo info;
+            segments++;
+
+            if (!world.hit(ray, info))
+                break;
+
+            color emitted = info.material->emitted(info);
+
+            if (scattering_pdf > 0.0 && !emitted.near_zero())
+                emitted *= misWeight(scattering_pdf, lightPdf(ray, info.root));
 
-        HitInfo info;
+            radiance += throughput * emitted;
 
-        if (!world.hit(ray, info))
-            return color(0.0, 0.0, 0.0);
+            Ray scattered;
+            color attenuation;
 
-        color emitted = info.material->emitted(info);
+            if (!info.material->scatter(ray, info, attenuation, scattered, sampler))
+                break;
 
-        Ray scattered;
-        color attenuation;
+            double pdf = info.material->scatteringPdf(ray, info, scattered.getDirection());
+            scattering_pdf = 0.0;
 
-        // Recursive ray scattering
-        if (info.material->scatter(ray, info, attenuation, scattered))
-            return emitted + attenuation * rayColor(scattered, world, depth-1);
+            if (!lights.empty() && pdf > 0.0) {
+                int count = static_cast<int>(lights.size());
+                int pick = std::min(static_cast<int>(random_double(sampler) * count), count - 1);
 
-        return emitted;
+                const Hittable &light = *lights[pick];
+                vector direction;
+
+                double light_pdf = light.sampleDirection(info.hit_point, sampler, direction) / count;
+
+                if (light_pdf > 0.0) {
+                    Ray shadow = Ray(info.hit_point, direction);
+                    double shadow_pdf = info.material->scatteringPdf(ray, info, shadow.getDirection());
+
+                    // The light alone gives the distance and the emission; the
+                    // rest of the scene only has to be empty up to it
+                    HitInfo light_info;
+
+                    if (shadow_pdf > 0.0 && light.hit(shadow, light_info)) {
+                        color emission = light_info.material->emitted(light_info);
+
+                        if (!emission.near_zero()) {
+                            segments++;
+
+                            if (!world.occluded(shadow, light_info.root - 0.001))
+                                radiance += throughput * attenuation * emission *
+                                    (shadow_pdf / light_pdf * misWeight(light_pdf, shadow_pdf));
+                        }
+                    }
+                }
+
+                scattering_pdf = pdf;
+            }
+
+            throughput = throughput * attenuation;
+            ray = scattered;
+
+            // Russian roulette: paths that can carry little light are ended at
+            // random, and the survivors are weighted up so the estimate stays
+            // unbiased
+            if (depth + 1 >= m_roulette_depth) {
+                double survival = std::max(throughput[0], std::max(throughput[1], throughput[2]));
+                if (survival > 0.95) survival = 0.95;
+
+                if (random_double(sampler) >= survival)
+                    break;
+
+                throughput /= survival;
+            }
+        }
+
+        return radiance;
     }
 
-    void render(ImageHandler &handler, const HittableList &world) {
-        int i, j;
+    color samplePixel(int i, int j, const Hittable &world, Sampler &sampler, int &segments) {
+        double u, v;
+        sampler.get2D(u, v);
+
+        vector pixel_pos = m_viewport_anchor;
+
+        pixel_pos += (i + u - 0.5) * m_delta_u;
+        pixel_pos += (j + v - 0.5) * m_delta_v;
 
-        color * pixels = new color[m_width * m_height];
+        Ray ray = Ray(pixel_pos, pixel_pos - m_position);
 
-        int num_threads = omp_get_num_procs();  // Gets total num of threads
+        return rayColor(ray, world, sampler, segments);
+    }
+
+    // Samples in passes. Each pass gives a batch to every pixel still above
+    // the error threshold, until they all reach it or the budget of
+    // aa_sampling samples per pixel is spent. With a time budget the passes
+    // go on until the time is up, and stop in the middle of one if need be,
+    // as they do when a stop is requested. The first passes only double the
+    // samples of each pixel, from one up to a batch, so that a render stopped
+    // early has a value for every pixel.
+    void render(ImageHandler &handler, const Hittable &world) {
+        int pixel_count = m_width * m_height;
+
+        if (!m_resuming) m_framebuffer.reset(m_width, m_height, m_seed);
+        m_resuming = false;
+
+        Framebuffer &estimates = m_framebuffer;
+
+        double render_start = omp_get_wtime();
+        bool timed = m_time_budget > 0.0;
+        double deadline = render_start + m_time_budget;
+
+        int num_threads = (m_threads > 0) ? m_threads : omp_get_num_procs();
         omp_set_dynamic(0);                     // Sets num of max threds used in parallel block
         omp_set_num_threads(num_threads);       // Sets num of threads used in a parallel block
 
-        #pragma omp parallel for private(i) schedule(dynamic, 10)
-        for (j = 0; j < m_height; j++) {
-            for (i = 0; i < m_width; i++) {
-                color pixel_color = color(0.0, 0.0, 0.0);
+        bool adaptive = m_error_threshold > 0.0;
+        double threshold = m_error_threshold;
+
+        int max_samples = adaptive ? m_max_sample_scale * aa_sampling : aa_sampling;
+        if (timed) max_samples = std::numeric_limits<int>::max();
+
+        // Active pixels stay in tile order, so a run of them is a tile. Pixels
+        // of a checkpoint may be done already.
+        TileLayout layout = TileLayout(m_width, m_height, m_tile_size, m_tile_order);
+        std::vector<int> active;
+
+        // The error of fewer samples than a batch is too rough to stop on
+        auto needs_samples = [&](const PixelEstimate &estimate) {
+            return estimate.count < max_samples &&
+                (!adaptive || estimate.count < m_batch_size || estimate.error() > threshold);
+        };
+
+        auto activate = [&]() {
+            for (int pixel: layout.getPixels()) {
+                if (needs_samples(estimates[pixel]))
+                    active.push_back(pixel);
+            }
+        };
+
+        activate();
+
+        std::vector<int> tile_starts;
+        WorkQueues queues;
+
+        m_busy_times.assign(num_threads, 0.0);
+        m_idle_times.assign(num_threads, 0.0);
+
+        long long budget = timed ?
+            std::numeric_limits<long long>::max() : static_cast<long long>(pixel_count) * aa_sampling;
+        long long resumed = estimates.getSampleCount();
+        long long spent = resumed;
+        long long path_segments = 0;
+        long long steals = 0;
+        double parallel_time = 0.0;
+
+        std::unique_ptr<PreviewWriter> preview;
+        bool previewing = !m_preview_filename.empty() && (m_preview_interval > 0.0 || m_preview_passes > 0);
+
+        if (previewing)
+            preview = std::make_unique<PreviewWriter>(m_preview_filename, m_width, m_height);
+
+        double last_preview = omp_get_wtime();
+        int passes_since_preview = 0;
+        bool previewed = false;
+
+        double last_checkpoint = omp_get_wtime();
+
+        auto stopping = [&]() {
+            return render_stop_requested.load(std::memory_order_relaxed) ||
+                (timed && omp_get_wtime() >= deadline);
+        };
+
+        // Samples each pixel is brought up to in the pass, doubled after it
+        // until it reaches the batch size; unlimited from then on
+        int ramp = 1;
+
+        // Pixels without a sample are rendered even once the render stops, so
+        // that none is left black
+        auto unsampled = [&]() {
+            for (int pixel: active) {
+                if (estimates[pixel].count == 0) return true;
+            }
+
+            return false;
+        };
+
+        while (unsampled() || !stopping()) {
+            // Time is left once all pixels converge: aim lower, or without a
+            // threshold simply start another pass over the whole image
+            if (timed && active.empty()) {
+                if (adaptive) threshold *= 0.5;
+                activate();
+            }
+
+            if (active.empty()) break;
+
+            // Never more than an even share of what is left of the budget
+            long long share = (budget - spent) / static_cast<long long>(active.size());
+            int batch = static_cast<int>(std::min<long long>(m_batch_size, share));
+
+            if (batch == 0) break;
+
+            tile_starts.clear();
+
+            for (int k = 0; k < static_cast<int>(active.size()); k++) {
+                if (k == 0 || layout.tileOf(active[k]) != layout.tileOf(active[k - 1]))
+                    tile_starts.push_back(k);
+            }
+
+            int tile_count = static_cast<int>(tile_starts.size());
+            tile_starts.push_back(static_cast<int>(active.size()));
+
+            queues.reset(tile_count, num_threads);
+            double pass_start = omp_get_wtime();
+
+            bool filling = unsampled();
+
+            #pragma omp parallel reduction(+:path_segments, spent, steals)
+            {
+                int thread = omp_get_thread_num();
 
-                // Anti-aliasing sampling
-                for (int sample = 0; sample < aa_sampling; sample++) {
-                    vector pixel_pos = m_viewport_anchor;
+                std::unique_ptr<Sampler> sampler = m_sampler->clone();
+                sampler->setSeed(m_seed);
 
-                    pixel_pos += (i + random_double() - 0.5) * m_delta_u;
-                    pixel_pos += (j + random_double() - 0.5) * m_delta_v;
+                int tile;
+                bool stolen;
+                bool out_of_time = false;
 
-                    Ray ray = Ray(pixel_pos, pixel_pos - m_position);
-                    pixel_color += rayColor(ray, world, max_depth);
+                // Summed here and stored once, so threads do not share its cache line
+                double busy = 0.0;
+
+                while (!out_of_time && queues.next(thread, tile, stolen)) {
+                    double tile_start = omp_get_wtime();
+                    steals += stolen;
+
+                    for (int k = tile_starts[tile]; k < tile_starts[tile + 1]; k++) {
+                        int pixel = active[k];
+                        PixelEstimate &estimate = estimates[pixel];
+
+                        // Pixels left out keep what they had, which is still
+                        // unbiased, but those with nothing yet get their sample
+                        if (stopping()) {
+                            if (!filling) {
+                                out_of_time = true;
+                                break;
+                            }
+
+                            if (estimate.count > 0) continue;
+                        }
+
+                        int samples = std::min(batch, std::min(max_samples, ramp) - estimate.count);
+                        if (samples <= 0) continue;
+
+                        // Samples are numbered within their pixel, so the image does
+                        // not depend on how they are split into batches or threads
+                        for (int sample = 0; sample < samples; sample++) {
+                            sampler->startSample(pixel, estimate.count);
+
+                            int segments;
+                            estimate.add(samplePixel(pixel % m_width, pixel / m_width, world, *sampler, segments));
+                            path_segments += segments;
+                        }
+
+                        spent += samples;
+                    }
+
+                    busy += omp_get_wtime() - tile_start;
                 }
 
-                pixels[j * m_width + i] =
-                    color(
-                        // Gamma correction and anti-aliasing sampling
-                        std::sqrt(pixel_color[0] / aa_sampling),
-                        std::sqrt(pixel_color[1] / aa_sampling),
-                        std::sqrt(pixel_color[2] / aa_sampling)
-                    )
-                ;
+                m_busy_times[thread] += busy;
+            }
+
+            // Includes the wait of every thread for the slowest one
+            parallel_time += omp_get_wtime() - pass_start;
+
+            int kept = 0;
+            for (int pixel: active) {
+                if (needs_samples(estimates[pixel]))
+                    active[kept++] = pixel;
+            }
+
+            active.resize(kept);
+
+            ramp = (ramp < m_batch_size) ? std::min(2 * ramp, m_batch_size) : std::numeric_limits<int>::max();
+
+            // Snapshots between passes, when no thread is writing to the
+            // estimates; the writer encodes it while the next pass runs
+            passes_since_preview++;
+            double now = omp_get_wtime();
+
+            bool due = !previewed ||
+                (m_preview_interval > 0.0 && now - last_preview >= m_preview_interval) ||
+                (m_preview_passes > 0 && passes_since_preview >= m_preview_passes);
+
+            if (!m_checkpoint_filename.empty() && m_checkpoint_interval > 0.0 &&
+                now - last_checkpoint >= m_checkpoint_interval) {
+                estimates.save(m_checkpoint_filename);
+                last_checkpoint = now;
+            }
+
+            if (previewing && due && !active.empty()) {
+                std::vector<color> snapshot(pixel_count);
+
+                for (int pixel = 0; pixel < pixel_count; pixel++)
+                    snapshot[pixel] = estimates[pixel].display();
+
+                preview->submit(std::move(snapshot));
+
+                last_preview = now;
+                passes_since_preview = 0;
+                previewed = true;
             }
         }
 
-        for (j = 0; j < m_height; j++) {
-            for (i = 0; i < m_width; i++)
-                handler.putPixel(pixels[j * m_width + i]);
+        if (!m_checkpoint_filename.empty())
+            estimates.save(m_checkpoint_filename);
+
+        m_sample_counts.resize(pixel_count);
+
+        for (int pixel = 0; pixel < pixel_count; pixel++)
+            m_sample_counts[pixel] = estimates[pixel].count;
+
+        m_preview_count = 0;
+
+        if (preview) {
+            preview->finish();
+            m_preview_count = preview->getWrittenCount();
+        }
+
+        m_render_time = omp_get_wtime() - render_start;
+
+        m_path_count = spent - resumed;
+        m_path_segments = path_segments;
+        m_steal_count = steals;
+
+        for (int thread = 0; thread < num_threads; thread++)
+            m_idle_times[thread] = parallel_time - m_busy_times[thread];
+
+        // Gamma correction and anti-aliasing sampling
+        for (int pixel = 0; pixel < pixel_count; pixel++)
+            handler.putPixel(estimates[pixel].display());
+    }
+
+    // Writes the samples of each pixel in the last render as a grey level,
+    // white for the pixel that took the most
+    void writeSampleMap(ImageHandler &handler) const {
+        int most = 1;
+        for (int count: m_sample_counts) most = std::max(most, count);
+
+        for (int count: m_sample_counts) {
+            double level = static_cast<double>(count) / most;
+            handler.putPixel(color(level, level, level));
         }
     }
 
@@ -11,24 +11,27 @@ double clamp(double value) {
 }
 
 
-class color: public vector {
+template <typename T>
+class basic_color: public basic_vector<T> {
 public:
-    color() : vector() {}
+    basic_color() : basic_vector<T>() {}
 
-    color(double e0, double e1, double e2) : vector(e0, e1, e2) {}
+    basic_color(T e0, T e1, T e2) : basic_vector<T>(e0, e1, e2) {}
 
-    color(const vector &v) : vector(v.e[0], v.e[1], v.e[2]) {}
+    basic_color(const basic_vector<T> &v) : basic_vector<T>(v) {}
 
-    int r() const { return static_cast<int>(255 * clamp(e[0])); }
-    int g() const { return static_cast<int>(255 * clamp(e[1])); }
-    int b() const { return static_cast<int>(255 * clamp(e[2])); }
+    int r() const { return static_cast<int>(255 * clamp(this->e[0])); }
+    int g() const { return static_cast<int>(255 * clamp(this->e[1])); }
+    int b() const { return static_cast<int>(255 * clamp(this->e[2])); }
 
-    ~color() = default;
+    friend std::ostream &operator<<(std::ostream &out, const basic_color &c) {
+        return out << c.r() << " " << c.g() << " " << c.b();
+    }
+
+    ~basic_color() = default;
 };
 
 
-inline std::ostream &operator<<(std::ostream &out, const color &c) {
-    return out << c.r() << " " << c.g() << " " << c.b();
-}
+using color = basic_color<real>;
 
 #endif
@@ -0,0 +1,72 @@
+#ifndef CPU_H
+#define CPU_H
+
+// Runtime detection of the vector instruction sets, so one binary can take the
+// widest code path every machine in a mixed farm supports
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define RT_X86
+
+    #include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Compiles a single function for AVX2 + FMA without raising the baseline
+#if defined(RT_X86) && (defined(__GNUC__) || defined(__clang__))
+    #define TARGET_AVX2 __attribute__((target("avx2,fma")))
+    #define FLATTEN __attribute__((flatten))
+#else
+    #define TARGET_AVX2
+    #define FLATTEN
+#endif
+
+
+inline int lowest_set_bit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+
+    return static_cast<int>(index);
+#else
+    int index = 0;
+    while (!(mask & 1u)) { mask >>= 1; index++; }
+
+    return index;
+#endif
+}
+
+
+inline bool cpu_supports_avx2() {
+#if defined(RT_X86) && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported =
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+    return supported;
+
+#elif defined(RT_X86) && defined(_MSC_VER)
+    static const bool supported = []() {
+        int info[4];
+
+        __cpuid(info, 1);
+        bool os_saves_ymm = (info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+        bool fma = info[2] & (1 << 12);
+
+        __cpuidex(info, 7, 0);
+        bool avx2 = info[1] & (1 << 5);
+
+        return os_saves_ymm && fma && avx2;
+    }();
+
+    return supported;
+
+#else
+    return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "color.hpp"
+
+
+// Running estimate of one pixel, in floats to halve the size of the
+// framebuffer. Welford's update keeps the variance of the sample
+// luminances stable however many samples there are.
+struct PixelEstimate {
+    float sum[3] = { 0.0f, 0.0f, 0.0f };
+    int32_t count = 0;
+
+    float mean = 0.0f;
+    float m2 = 0.0f;   // Sum of squared deviations from the mean
+
+    void add(const color &sample) {
+        sum[0] += static_cast<float>(sample[0]);
+        sum[1] += static_cast<float>(sample[1]);
+        sum[2] += static_cast<float>(sample[2]);
+        count++;
+
+        double luminance = 0.2126 * sample[0] + 0.7152 * sample[1] + 0.0722 * sample[2];
+        double delta = luminance - mean;
+
+        mean += static_cast<float>(delta / count);
+        m2 += static_cast<float>(delta * (luminance - mean));
+    }
+
+    // Of the sample luminances
+    double variance() const {
+        return (count > 1) ? m2 / (count - 1.0) : 0.0;
+    }
+
+    // Standard error of the displayed value. The image is stored as the square
+    // root of the mean, which turns an error e of the mean into e / (2 sqrt(mean)).
+    double error() const {
+        if (count < 2) return std::numeric_limits<double>::infinity();
+
+        double standard_error = std::sqrt(variance() / count);
+
+        return standard_error / (2.0 * std::sqrt(std::max<double>(mean, 1e-6)));
+    }
+
+    // Gamma corrected mean, black before the first sample
+    color display() const {
+        double samples = std::max(count, 1);
+
+        return color(
+            std::sqrt(sum[0] / samples),
+            std::sqrt(sum[1] / samples),
+            std::sqrt(sum[2] / samples));
+    }
+};
+
+
+// Layout of a framebuffer checkpoint: this header, then the estimates of
+// the pixels row by row, stored exactly as they are in memory
+struct FramebufferFileHeader {
+    char magic[8];            // "RTFRAME" followed by a zero
+    uint32_t version;
+    uint32_t byte_order;      // framebuffer_file_byte_order as the writer saw it
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_size;      // sizeof(PixelEstimate) of the writer
+    uint32_t padding;
+    uint64_t seed;            // Of the render, so a resumed one draws the same samples
+};
+
+
+const char framebuffer_file_magic[8] = { 'R', 'T', 'F', 'R', 'A', 'M', 'E', 0 };
+const uint32_t framebuffer_file_version = 1;
+const uint32_t framebuffer_file_byte_order = 0x01020304;
+
+
+// Estimates of every pixel of an image, kept from one render to the next so
+// that a render can go on where an earlier one stopped
+class Framebuffer {
+private:
+    int m_width = 0;
+    int m_height = 0;
+    uint64_t m_seed = 0;
+
+    std::vector<PixelEstimate> m_pixels;
+
+public:
+    Framebuffer() {}
+
+    Framebuffer(int t_width, int t_height, uint64_t t_seed) {
+        reset(t_width, t_height, t_seed);
+    }
+
+    // Back to no samples at all
+    void reset(int t_width, int t_height, uint64_t t_seed) {
+        m_width = t_width;
+        m_height = t_height;
+        m_seed = t_seed;
+
+        m_pixels.assign(static_cast<size_t>(m_width) * m_height, PixelEstimate());
+    }
+
+    int getWidth() const { return m_width; }
+
+    int getHeight() const { return m_height; }
+
+    uint64_t getSeed() const { return m_seed; }
+
+    int getPixelCount() const { return static_cast<int>(m_pixels.size()); }
+
+    PixelEstimate &operator[](int pixel) { return m_pixels[pixel]; }
+
+    const PixelEstimate &operator[](int pixel) const { return m_pixels[pixel]; }
+
+    long long getSampleCount() const {
+        long long samples = 0;
+        for (const PixelEstimate &pixel: m_pixels) samples += pixel.count;
+
+        return samples;
+    }
+
+    // Written next to filename and renamed over it, so a job killed while
+    // saving leaves the previous checkpoint whole
+    bool save(const std::string &filename) const {
+        FramebufferFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, framebuffer_file_magic, sizeof(header.magic));
+
+        header.version = framebuffer_file_version;
+        header.byte_order = framebuffer_file_byte_order;
+        header.width = static_cast<uint32_t>(m_width);
+        header.height = static_cast<uint32_t>(m_height);
+        header.pixel_size = sizeof(PixelEstimate);
+        header.seed = m_seed;
+
+        std::string temporary = filename + ".tmp";
+
+        {
+            std::ofstream file(temporary, std::ios::binary);
+
+            if (!file) {
+                std::cerr << "ERROR: Could not create '" << temporary << "'.\n";
+                return false;
+            }
+
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(
+                reinterpret_cast<const char *>(m_pixels.data()),
+                static_cast<std::streamsize>(m_pixels.size() * sizeof(PixelEstimate)));
+
+            if (!file) {
+                std::cerr << "ERROR: Could not write '" << temporary << "'.\n";
+                return false;
+            }
+        }
+
+        if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+            std::cerr << "ERROR: Could not replace '" << filename << "'.\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Leaves the framebuffer as it was if the file cannot be used
+    bool load(const std::string &filename) {
+        std::ifstream file(filename, std::ios::binary);
+
+        if (!file) {
+            std::cerr << "ERROR: Could not open '" << filename << "'.\n";
+            return false;
+        }
+
+        FramebufferFileHeader header;
+        file.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+        if (!file || std::memcmp(header.magic, framebuffer_file_magic, sizeof(header.magic)) != 0 ||
+            header.version != framebuffer_file_version) {
+            std::cerr << "ERROR: '" << filename << "' is not a version " << framebuffer_file_version << " checkpoint.\n";
+            return false;
+        }
+
+        if (header.byte_order != framebuffer_file_byte_order || header.pixel_size != sizeof(PixelEstimate)) {
+            std::cerr << "ERROR: '" << filename << "' was written by a different build.\n";
+            return false;
+        }
+
+        if (header.width == 0 || header.height == 0 || header.width > 0x7fff || header.height > 0x7fff) {
+            std::cerr << "ERROR: '" << filename << "' has an invalid size.\n";
+            return false;
+        }
+
+        std::vector<PixelEstimate> pixels(static_cast<size_t>(header.width) * header.height);
+
+        file.read(
+            reinterpret_cast<char *>(pixels.data()),
+            static_cast<std::streamsize>(pixels.size() * sizeof(PixelEstimate)));
+
+        if (!file) {
+            std::cerr << "ERROR: '" << filename << "' is truncated.\n";
+            return false;
+        }
+
+        m_width = static_cast<int>(header.width);
+        m_height = static_cast<int>(header.height);
+        m_seed = header.seed;
+        m_pixels.swap(pixels);
+
+        return true;
+    }
+
+    ~Framebuffer() = default;
+};
+
+#endif
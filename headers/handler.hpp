@@ -90,9 +90,12 @@ public:
             return;
         }
 
-        m_pixels[++m_index] = t_color.g();
-        m_pixels[++m_index] = t_color.b();
-        m_pixels[++m_index] = t_color.r();
+        // Stays inside the buffer if more pixels are put than it holds
+        if (m_index + 3 > 3 * m_width * m_height) return;
+
+        m_pixels[m_index++] = t_color.r();
+        m_pixels[m_index++] = t_color.g();
+        m_pixels[m_index++] = t_color.b();
     }
 
     ~ImageHandler() {
@@ -107,6 +110,8 @@ public:
             stbi_write_png(
                 m_filename.c_str(), m_width, m_height, 3, m_pixels, 3 * m_width);
         }
+
+        delete[] m_pixels;
     }
 };
 
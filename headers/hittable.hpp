@@ -1,40 +1,60 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
-#include <memory>
+#include <algorithm>
 #include <vector>
 
+#include "sampler.hpp"
 #include "ray.hpp"
+#include "aabb.hpp"
 
 
 class Material;
 
 
-struct HitInfo {
-    double root;
-    point hit_point;
-    vector normal;
-    std::shared_ptr<Material> material;
-    double texture_u;
-    double texture_v;
+template <typename T>
+struct BasicHitInfo {
+    T root;
+    basic_vector<T> hit_point;
+    basic_vector<T> normal;
+    const Material * material = nullptr;   // Non-owning; the hit object keeps it alive
+    T texture_u;
+    T texture_v;
 };
 
 
+using HitInfo = BasicHitInfo<real>;
+
+
 class Hittable {
 private:
-    std::shared_ptr<Material> m_material;
+    const Material * m_material = nullptr;   // Non-owning; the scene arena keeps it alive
 
 public:
-    Hittable() : m_material(std::shared_ptr<Material>()) {}
+    Hittable() {}
 
-    Hittable(std::shared_ptr<Material> t_material) {
+    Hittable(const Material * t_material) {
         m_material = t_material;
     }
 
-    std::shared_ptr<Material> getMaterial() const { return m_material; }
+    const Material * getMaterial() const { return m_material; }
 
     virtual bool hit(const Ray &ray, HitInfo &info) const = 0;
 
+    // Whether anything lies along the ray closer than t_max. Stops at the
+    // first hit found and computes nothing else, which is all shadow rays need.
+    virtual bool occluded(const Ray &ray, double t_max) const = 0;
+
+    // Tight axis-aligned bounds; AABB::infinite() for unbounded primitives
+    virtual AABB boundingBox() const = 0;
+
+    // Light sampling: picks a direction from origin towards the object and
+    // returns its pdf over solid angle. Zero means no direction was picked.
+    virtual double sampleDirection(const point &, Sampler &, vector &) const { return 0.0; }
+
+    // Solid angle pdf of sampleDirection picking direction from origin
+    virtual double directionPdf(const point &, const vector &) const { return 0.0; }
+
     ~Hittable() = default;
 };
 
@@ -50,7 +70,7 @@ public:
         m_radius = 1.0;
     }
 
-    Sphere(point t_center, double t_radius, std::shared_ptr<Material> t_material) : Hittable(t_material) {
+    Sphere(point t_center, double t_radius, const Material * t_material) : Hittable(t_material) {
         m_center = t_center;
         m_radius = t_radius;
     }
@@ -59,7 +79,14 @@ public:
 
     double getRadius() const { return m_radius; }
 
-    bool hit(const Ray &ray, HitInfo &info) const override {
+    AABB boundingBox() const override {
+        vector radius = vector(m_radius, m_radius, m_radius);
+
+        return AABB(m_center - radius, m_center + radius);
+    }
+
+    // Nearest root past the self-intersection epsilon
+    bool intersect(const Ray &ray, double &root) const {
         point origin = ray.getOrigin();
         vector direction = ray.getDirection();
 
@@ -71,13 +98,20 @@ public:
         if (delta < 0.0) return false;
 
         double sqrt_delta = sqrt(delta);
-        double root = -b - sqrt_delta;
+        root = -b - sqrt_delta;
 
         if (root < 0.001) {
             root = -b + sqrt_delta;
             if (root < 0.001) return false;
         }
 
+        return true;
+    }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        double root;
+        if (!intersect(ray, root)) return false;
+
         info.root = root;
         info.hit_point = ray.at(root);
         info.normal = normalize(info.hit_point - m_center);
@@ -89,6 +123,50 @@ public:
         return true;
     }
 
+    bool occluded(const Ray &ray, double t_max) const override {
+        double root;
+        return intersect(ray, root) && root < t_max;
+    }
+
+    // Uniform over the cone of directions in which the sphere is seen
+    double sampleDirection(const point &origin, Sampler &sampler, vector &direction) const override {
+        vector axis = m_center - origin;
+        double distance_squared = axis.squared_norm();
+        double radius_squared = m_radius * m_radius;
+
+        if (distance_squared <= radius_squared) return 0.0;
+
+        double sin_max_squared = radius_squared / distance_squared;
+        double cos_max = std::sqrt(1.0 - sin_max_squared);
+
+        // 1 - cos_max, without the cancellation of small or distant spheres
+        double one_minus_cos_max = sin_max_squared / (1.0 + cos_max);
+
+        double a, b;
+        sampler.get2D(a, b);
+
+        ONB basis = ONB(axis / std::sqrt(distance_squared));
+        direction = basis.toWorld(sample_uniform_cone(a, b, one_minus_cos_max));
+
+        return uniform_cone_pdf(one_minus_cos_max);
+    }
+
+    double directionPdf(const point &origin, const vector &direction) const override {
+        vector axis = m_center - origin;
+        double distance_squared = axis.squared_norm();
+        double radius_squared = m_radius * m_radius;
+
+        if (distance_squared <= radius_squared) return 0.0;
+
+        double sin_max_squared = radius_squared / distance_squared;
+        double cos_max = std::sqrt(1.0 - sin_max_squared);
+
+        double cos_theta = dot(axis, direction) / std::sqrt(distance_squared * direction.squared_norm());
+        if (cos_theta < cos_max) return 0.0;
+
+        return uniform_cone_pdf(sin_max_squared / (1.0 + cos_max));
+    }
+
     ~Sphere() = default;
 };
 
@@ -104,7 +182,7 @@ public:
         m_normal = vector(0.0, 0.0, 1.0);
     }
 
-    Plane(point t_point, vector t_normal, std::shared_ptr<Material> t_material) : Hittable(t_material) {
+    Plane(point t_point, vector t_normal, const Material * t_material) : Hittable(t_material) {
         m_point = t_point;
         m_normal = normalize(t_normal);
     }
@@ -113,18 +191,23 @@ public:
 
     vector getNormal() const { return m_normal; }
 
-    bool hit(const Ray &ray, HitInfo &info) const override {
-        point origin = ray.getOrigin();
-        vector direction = ray.getDirection();
+    // A plane extends to infinity, even when it is axis-aligned
+    AABB boundingBox() const override { return AABB::infinite(); }
 
-        double den = dot(direction, m_normal);
+    bool intersect(const Ray &ray, double &root) const {
+        double den = dot(ray.getDirection(), m_normal);
 
         if (den == 0.0) return false;
 
-        double num = dot(m_point - origin, m_normal);
-        double root = num / den;
+        double num = dot(m_point - ray.getOrigin(), m_normal);
+        root = num / den;
 
-        if (root < 0.001) return false;
+        return root >= 0.001;
+    }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        double root;
+        if (!intersect(ray, root)) return false;
 
         info.root = root;
         info.hit_point = ray.at(root);
@@ -138,6 +221,11 @@ public:
         return true;
     }
 
+    bool occluded(const Ray &ray, double t_max) const override {
+        double root;
+        return intersect(ray, root) && root < t_max;
+    }
+
     ~Plane() = default;
 };
 
@@ -157,7 +245,7 @@ public:
         m_normal = cross(m_vector_u, m_vector_v);
     }
 
-    Quad(point t_point, vector t_vector_u, vector t_vector_v, std::shared_ptr<Material> t_material) : Hittable(t_material) {
+    Quad(point t_point, vector t_vector_u, vector t_vector_v, const Material * t_material) : Hittable(t_material) {
         m_point = t_point;
         m_vector_u = t_vector_u;
         m_vector_v = t_vector_v;
@@ -172,25 +260,37 @@ public:
 
     vector getNormal() const { return m_normal; }
 
-    bool hit(const Ray &ray, HitInfo &info) const override {
-        point origin = ray.getOrigin();
-        vector direction = ray.getDirection();
+    AABB boundingBox() const override {
+        AABB box = AABB(m_point, m_point + m_vector_u + m_vector_v);
+        box.expand(AABB(m_point + m_vector_u, m_point + m_vector_v));
+
+        return box.padded(1e-4);
+    }
 
-        double den = dot(direction, m_normal);
+    // Root and position of the hit in the parallelogram, both in [0, 1]
+    bool intersect(const Ray &ray, double &root, float &u_pos, float &v_pos) const {
+        double den = dot(ray.getDirection(), m_normal);
 
         if (den == 0.0) return false;
 
-        double num = dot(m_point - origin, m_normal);
-        double root = num / den;
+        double num = dot(m_point - ray.getOrigin(), m_normal);
+        root = num / den;
 
         if (root < 0.001) return false;
 
         vector delta = ray.at(root) - m_point;
 
-        float u_pos = dot(delta, m_vector_u) / m_vector_u.squared_norm();
-        float v_pos = dot(delta, m_vector_v) / m_vector_v.squared_norm();
+        u_pos = dot(delta, m_vector_u) / m_vector_u.squared_norm();
+        v_pos = dot(delta, m_vector_v) / m_vector_v.squared_norm();
 
-        if (u_pos < 0 || 1 < u_pos || v_pos < 0 || 1 < v_pos) return false;
+        return !(u_pos < 0 || 1 < u_pos || v_pos < 0 || 1 < v_pos);
+    }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        double root;
+        float u_pos, v_pos;
+
+        if (!intersect(ray, root, u_pos, v_pos)) return false;
 
         info.root = root;
         info.hit_point = ray.at(root);
@@ -203,6 +303,38 @@ public:
         return true;
     }
 
+    bool occluded(const Ray &ray, double t_max) const override {
+        double root;
+        float u_pos, v_pos;
+
+        return intersect(ray, root, u_pos, v_pos) && root < t_max;
+    }
+
+    // Uniform over the area of the quad. With the offset d to the point and
+    // the normal n = u x v, the area pdf 1 / |n| becomes |d|³ / |d·n|.
+    double sampleDirection(const point &origin, Sampler &sampler, vector &direction) const override {
+        double a, b;
+        sampler.get2D(a, b);
+
+        direction = m_point + a * m_vector_u + b * m_vector_v - origin;
+
+        double den = std::fabs(dot(direction, m_normal));
+        if (den == 0.0) return 0.0;
+
+        return direction.squared_norm() * direction.norm() / den;
+    }
+
+    double directionPdf(const point &origin, const vector &direction) const override {
+        HitInfo info;
+        if (!hit(Ray(origin, direction), info)) return 0.0;
+
+        vector offset = info.hit_point - origin;
+        double den = std::fabs(dot(offset, m_normal));
+        if (den == 0.0) return 0.0;
+
+        return offset.squared_norm() * offset.norm() / den;
+    }
+
     ~Quad() = default;
 };
 
@@ -212,7 +344,7 @@ private:
     point m_center;
     vector m_sizes;
 
-    std::vector<std::shared_ptr<Quad>> m_faces;
+    Quad m_faces[6];
 
 public:
     Box() : Hittable() {
@@ -222,7 +354,7 @@ public:
         createFaces();
     }
 
-    Box(point t_center, vector t_sizes, std::shared_ptr<Material> t_material) : Hittable(t_material) {
+    Box(point t_center, vector t_sizes, const Material * t_material) : Hittable(t_material) {
         m_center = t_center;
         m_sizes = t_sizes;
 
@@ -237,18 +369,34 @@ public:
         vector y = vector(0.0, m_sizes[1] * 1.0, 0.0);
         vector z = vector(0.0, 0.0, m_sizes[2] * 1.0);
 
-        m_faces.push_back(std::make_shared<Quad>(point_A, -x, -y, getMaterial()));
-        m_faces.push_back(std::make_shared<Quad>(point_A, -y, -z, getMaterial()));
-        m_faces.push_back(std::make_shared<Quad>(point_A, -z, -x, getMaterial()));
-        m_faces.push_back(std::make_shared<Quad>(point_B,  y,  x, getMaterial()));
-        m_faces.push_back(std::make_shared<Quad>(point_B,  z,  y, getMaterial()));
-        m_faces.push_back(std::make_shared<Quad>(point_B,  x,  z, getMaterial()));
+        m_faces[0] = Quad(point_A, -x, -y, getMaterial());
+        m_faces[1] = Quad(point_A, -y, -z, getMaterial());
+        m_faces[2] = Quad(point_A, -z, -x, getMaterial());
+        m_faces[3] = Quad(point_B,  y,  x, getMaterial());
+        m_faces[4] = Quad(point_B,  z,  y, getMaterial());
+        m_faces[5] = Quad(point_B,  x,  z, getMaterial());
+    }
+
+    // Faces whose outward normal points towards origin
+    int facingFaces(const point &origin, int * faces) const {
+        int count = 0;
+
+        for (int i = 0; i < 6; i++) {
+            if (dot(origin - m_faces[i].getPoint(), m_faces[i].getNormal()) > 0.0)
+                faces[count++] = i;
+        }
+
+        return count;
     }
 
     point getCenter() const { return m_center; }
 
     vector getSizes() const { return m_sizes; }
 
+    AABB boundingBox() const override {
+        return AABB(m_center - 0.5 * m_sizes, m_center + 0.5 * m_sizes).padded(1e-4);
+    }
+
     bool hit(const Ray &ray, HitInfo &info) const override {
         point origin = ray.getOrigin();
         vector direction = ray.getDirection();
@@ -259,7 +407,7 @@ public:
         info.root = -1.0;
 
         for (int i = 0; i < 6; i++) {
-            if (m_faces[i]->hit(ray, curr)) {
+            if (m_faces[i].hit(ray, curr)) {
                 if (info.root == -1 || curr.root < info.root) {
                     index = i;
                     info = curr;
@@ -288,34 +436,75 @@ public:
         return true;
     }
 
+    bool occluded(const Ray &ray, double t_max) const override {
+        for (const Quad &face: m_faces) {
+            if (face.occluded(ray, t_max)) return true;
+        }
+
+        return false;
+    }
+
+    // Picks one of the faces turned towards origin. The box is convex, so a
+    // direction meets exactly one of them and its pdf needs no sum.
+    double sampleDirection(const point &origin, Sampler &sampler, vector &direction) const override {
+        int facing[6];
+        int count = facingFaces(origin, facing);
+
+        if (count == 0) return 0.0;
+
+        int pick = std::min(static_cast<int>(random_double(sampler) * count), count - 1);
+
+        return m_faces[facing[pick]].sampleDirection(origin, sampler, direction) / count;
+    }
+
+    double directionPdf(const point &origin, const vector &direction) const override {
+        int facing[6];
+        int count = facingFaces(origin, facing);
+
+        for (int i = 0; i < count; i++) {
+            double pdf = m_faces[facing[i]].directionPdf(origin, direction);
+            if (pdf > 0.0) return pdf / count;
+        }
+
+        return 0.0;
+    }
+
     ~Box() = default;
 };
 
 
 class HittableList: public Hittable {
 private:
-    std::vector<std::shared_ptr<Hittable>> m_objects;
+    std::vector<const Hittable *> m_objects;   // Non-owning, like the materials
+
+    AABB m_bounds;
 
 public:
     HittableList() {}
 
-    HittableList(std::shared_ptr<Hittable> t_object) { add(t_object); }
+    HittableList(const Hittable * t_object) { add(t_object); }
 
-    std::vector<std::shared_ptr<Hittable>> getObjects() const { return m_objects; }
+    const std::vector<const Hittable *> &getObjects() const { return m_objects; }
 
-    void clear() { m_objects.clear(); }
+    void clear() {
+        m_objects.clear();
+        m_bounds = AABB();
+    }
 
-    void add(std::shared_ptr<Hittable> t_object) {
+    void add(const Hittable * t_object) {
         m_objects.push_back(t_object);
+        m_bounds.expand(t_object->boundingBox());
     }
 
+    AABB boundingBox() const override { return m_bounds; }
+
     bool hit(const Ray &ray, HitInfo &info) const override {
         HitInfo tmp_info;
 
         // Negative value to indicate the non-hit
         double root = -1.0;
 
-        for (const std::shared_ptr<Hittable> object: m_objects) {
+        for (const Hittable * object: m_objects) {
             if (object->hit(ray, tmp_info)) {
                 if (root == -1.0 || tmp_info.root < root) {
                     root = tmp_info.root;
@@ -327,6 +516,14 @@ public:
         return root != -1.0;
     }
 
+    bool occluded(const Ray &ray, double t_max) const override {
+        for (const Hittable * object: m_objects) {
+            if (object->occluded(ray, t_max)) return true;
+        }
+
+        return false;
+    }
+
     ~HittableList() = default;
 };
 
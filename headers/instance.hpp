@@ -0,0 +1,72 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.hpp"
+#include "transform.hpp"
+
+
+// Places shared geometry in the world. The geometry is usually the bottom
+// level BVH of a prototype, so its memory is paid once however many
+// instances there are.
+class Instance: public Hittable {
+private:
+    const Hittable * m_geometry;   // Non-owning; the scene arena keeps it alive
+    Transform m_transform;
+
+    AABB m_bounds;
+
+public:
+    Instance(const Hittable * t_geometry, const Transform &t_transform) : Hittable() {
+        m_geometry = t_geometry;
+        m_transform = t_transform;
+        m_bounds = m_transform.applyToBox(m_geometry->boundingBox());
+    }
+
+    // A non-null material replaces the materials of the prototype
+    Instance(const Hittable * t_geometry, const Transform &t_transform, const Material * t_material) : Hittable(t_material) {
+        m_geometry = t_geometry;
+        m_transform = t_transform;
+        m_bounds = m_transform.applyToBox(m_geometry->boundingBox());
+    }
+
+    const Hittable * getGeometry() const { return m_geometry; }
+
+    const Transform &getTransform() const { return m_transform; }
+
+    AABB boundingBox() const override { return m_bounds; }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        Ray local = Ray(
+            m_transform.inversePoint(ray.getOrigin()),
+            m_transform.inverseVector(ray.getDirection()));
+
+        if (!m_geometry->hit(local, info)) return false;
+
+        // Mapping the hit point back, rather than rescaling the root, keeps
+        // ray.at(root) on the surface whatever the local ray normalization did
+        info.hit_point = m_transform.applyToPoint(local.at(info.root));
+        info.root = dot(info.hit_point - ray.getOrigin(), ray.getDirection()) /
+            ray.getDirection().squared_norm();
+
+        info.normal = normalize(m_transform.applyToNormal(info.normal));
+
+        if (getMaterial()) info.material = getMaterial();
+
+        return true;
+    }
+
+    bool occluded(const Ray &ray, double t_max) const override {
+        vector direction = m_transform.inverseVector(ray.getDirection());
+
+        Ray local = Ray(m_transform.inversePoint(ray.getOrigin()), direction);
+
+        // The local ray has its own unit of length along the direction
+        double scale = direction.norm() / local.getDirection().norm();
+
+        return m_geometry->occluded(local, t_max * scale);
+    }
+
+    ~Instance() = default;
+};
+
+#endif
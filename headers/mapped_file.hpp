@@ -0,0 +1,121 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+// Read-only view of a whole file. Pages are only read from disk when touched,
+// so opening is instant whatever the size of the file.
+class MappedFile {
+private:
+    const char * m_data = nullptr;
+    size_t m_size = 0;
+
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = NULL;
+#endif
+
+public:
+    MappedFile() {}
+
+    MappedFile(const std::string &t_filename) {
+        open(t_filename);
+    }
+
+    // The view must stay put, since meshes point straight into it
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &t_filename) {
+        close();
+
+#ifdef _WIN32
+        m_file = CreateFileA(t_filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+
+        if (m_file == INVALID_HANDLE_VALUE) {
+            std::cerr << "ERROR: Could not open '" << t_filename << "'.\n";
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        GetFileSizeEx(m_file, &size);
+        m_size = static_cast<size_t>(size.QuadPart);
+
+        if (m_size > 0) {
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (m_mapping) m_data = static_cast<const char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        int descriptor = ::open(t_filename.c_str(), O_RDONLY);
+
+        if (descriptor < 0) {
+            std::cerr << "ERROR: Could not open '" << t_filename << "'.\n";
+            return false;
+        }
+
+        struct stat info;
+        fstat(descriptor, &info);
+        m_size = static_cast<size_t>(info.st_size);
+
+        if (m_size > 0) {
+            void * data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (data != MAP_FAILED) m_data = static_cast<const char *>(data);
+        }
+
+        // The mapping keeps the file alive on its own
+        ::close(descriptor);
+#endif
+
+        if (!m_data) {
+            std::cerr << "ERROR: Could not map '" << t_filename << "'.\n";
+            close();
+
+            return false;
+        }
+
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+
+        m_mapping = NULL;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data) munmap(const_cast<char *>(m_data), m_size);
+#endif
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    bool isOpen() const { return m_data != nullptr; }
+
+    const char * getData() const { return m_data; }
+
+    size_t getSize() const { return m_size; }
+
+    ~MappedFile() { close(); }
+};
+
+#endif
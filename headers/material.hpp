@@ -1,152 +1,205 @@
 #ifndef MEATERIAL_H
 #define MEATERIAL_H
 
+#include "sampler.hpp"
+#include "sampling.hpp"
 #include "texture.hpp"
 
 
+enum class MaterialType { light, lambertian, metal, dielectric };
+
+
+// Every kind of material is this one class, told apart by its type, so that
+// shading a hit is a switch the compiler can inline rather than a chain of
+// virtual calls into the material and then its texture. The classes below
+// only pick the type and the parameter; they must not add members.
 class Material {
 private:
-    std::shared_ptr<Texture> m_texture;
+    MaterialType m_type;
+    const Texture * m_texture = nullptr;   // Non-owning; the scene arena keeps it alive
 
-public:
-    Material() : m_texture(std::shared_ptr<SolidTexture>()) {}
+    double m_parameter = 0.0;   // GGX roughness of a metal, refractive index of a dielectric
 
-    Material(std::shared_ptr<Texture> t_texture) {
-        m_texture = t_texture;
+    // Unit normal on the side the ray came from
+    static vector facingNormal(const Ray &ray, const HitInfo &info) {
+        vector normal = info.normal / info.normal.norm();
+
+        return (dot(ray.getDirection(), normal) > 0.0) ? -normal : normal;
     }
 
-    std::shared_ptr<Texture> getTexture() const { return m_texture; }
+    static double reflectance(double cos, double ratio) {
+        // Use Schlick's approximation for reflectance
+        double r0 = pow((1.0 - ratio) / (1.0 + ratio), 2);
 
-    virtual color emitted(HitInfo &info) const { return color(0.0, 0.0, 0.0); };
+        return r0 + (1.0 - r0) * pow(1.0 - std::fabs(cos), 5);
+    }
 
-    virtual bool scatter(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered) const = 0;
+    color textureColor(const HitInfo &info) const {
+        return m_texture->getColorInTexture(
+            info.texture_u, info.texture_v, info.hit_point);
+    }
 
-    ~Material() = default;
-};
+    bool scatterLambertian(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered, Sampler &sampler) const {
+        double u, v;
+        sampler.get2D(u, v);
 
+        // Cosine distributed, so the cosine and the pdf cancel out
+        ONB basis = ONB(facingNormal(ray, info));
+        scattered = Ray(info.hit_point, basis.toWorld(sample_cosine_hemisphere(u, v)));
+        attenuation = textureColor(info);
 
-class LightSource: public Material {
-public:
-    LightSource() : Material() {}
+        return true;
+    }
 
-    LightSource(std::shared_ptr<Texture> t_texture) : Material(t_texture) {}
+    // Mirror roughened by a GGX distribution of microfacets, with fuzzy as its
+    // roughness alpha. It stays out of light sampling, like a perfect mirror.
+    bool scatterMetal(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered, Sampler &sampler) const {
+        double u, v;
+        sampler.get2D(u, v);
 
-    color emitted(HitInfo &info) const override {
-        return getTexture()->getColorInTexture(
-            info.texture_u, info.texture_v, info.hit_point);
-    }
+        vector normal = facingNormal(ray, info);
+        vector microfacet = ONB(normal).toWorld(sample_ggx_normal(u, v, m_parameter));
 
-    bool scatter(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered) const override {
-        return false;
-    }
+        vector incoming = -ray.getDirection() / ray.getDirection().norm();
+        double cos_microfacet = dot(incoming, microfacet);
 
-    ~LightSource() = default;
-};
+        // Microfacets facing away from the ray are not seen, and reflections
+        // off steep ones go into the surface
+        if (cos_microfacet <= 0.0) return false;
 
+        vector reflected = 2.0 * cos_microfacet * microfacet - incoming;
 
-class Lambertian: public Material {
-public:
-    Lambertian() : Material() {}
+        double cos_in = dot(incoming, normal);
+        double cos_out = dot(reflected, normal);
 
-    Lambertian(std::shared_ptr<Texture> t_texture) : Material(t_texture) {}
+        if (cos_out <= 0.0) return false;
 
-    bool scatter(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered) const override {
-        vector direction = info.normal + random_unit_vector();
+        scattered = Ray(info.hit_point, reflected);
 
-        // Catch degenerate scatter direction
-        if (direction.near_zero())
-            direction = info.normal;
+        // The BRDF F D G / (4 cos_in cos_out) times cos_out, over the pdf
+        // D cos_h / (4 cos_microfacet) of the reflected direction
+        double masking = ggx_smith_g1(cos_in, m_parameter) * ggx_smith_g1(cos_out, m_parameter);
+        double cos_h = dot(microfacet, normal);
 
-        scattered = Ray(info.hit_point, direction);
-        attenuation = getTexture()->getColorInTexture(
-            info.texture_u, info.texture_v, info.hit_point);
+        attenuation = textureColor(info) * (masking * cos_microfacet / (cos_in * cos_h));
 
         return true;
     }
 
-    ~Lambertian() = default;
-};
+    bool scatterDielectric(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered, Sampler &sampler) const {
+        double cos = dot(ray.getDirection(), info.normal);
+        double sin = std::sqrt(1.0 - cos * cos);
 
+        double ratio = (cos < 0.0) ?  1.0 / m_parameter : m_parameter;
 
-class Metal: public Material {
-private:
-    double m_fuzzy;
+        if (ratio * sin > 1.0 || random_double(sampler) < reflectance(cos, ratio)) {
+            vector reflected = ray.getDirection() -
+                2.0 * dot(ray.getDirection(), info.normal) * info.normal;
 
-public:
-    Metal() : Material() {
-        m_fuzzy = 0.2;
+            scattered = Ray(
+                info.hit_point, reflected + random_unit_vector(sampler));
+
+        } else {
+            vector perp = ratio * (ray.getDirection() - cos * info.normal);
+            vector paral = std::sqrt(1.0 - perp.squared_norm()) * info.normal;
+
+            scattered = Ray(
+                info.hit_point, (cos < 0.0) ? perp - paral : perp + paral);
+        }
+
+        attenuation = textureColor(info);
+
+        return true;
     }
 
-    Metal(std::shared_ptr<Texture> t_texture, double t_fuzzy) : Material(t_texture) {
-        m_fuzzy = t_fuzzy;
+protected:
+    Material(MaterialType t_type, const Texture * t_texture, double t_parameter = 0.0) {
+        m_type = t_type;
+        m_texture = t_texture;
+        m_parameter = t_parameter;
     }
 
-    double getFuzzy() const { return m_fuzzy; }
+    double getParameter() const { return m_parameter; }
 
-    bool scatter(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered) const override {
-        vector reflected = ray.getDirection() -
-            2.0 * dot(ray.getDirection(), info.normal) * info.normal;
+public:
+    MaterialType getType() const { return m_type; }
 
-        scattered = Ray(
-            info.hit_point, reflected + m_fuzzy * random_unit_vector());
-        attenuation = getTexture()->getColorInTexture(
-            info.texture_u, info.texture_v, info.hit_point);
+    const Texture * getTexture() const { return m_texture; }
 
-        return true;
+    color emitted(HitInfo &info) const {
+        return (m_type == MaterialType::light) ? textureColor(info) : color(0.0, 0.0, 0.0);
     }
 
-    ~Metal() = default;
-};
+    // Emitters are gathered into the light list of the scene
+    bool isEmissive() const { return m_type == MaterialType::light; }
 
+    bool scatter(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered, Sampler &sampler) const {
+        switch (m_type) {
+            case MaterialType::lambertian: return scatterLambertian(ray, info, attenuation, scattered, sampler);
+            case MaterialType::metal: return scatterMetal(ray, info, attenuation, scattered, sampler);
+            case MaterialType::dielectric: return scatterDielectric(ray, info, attenuation, scattered, sampler);
+            default: return false;
+        }
+    }
 
-class Dielectric: public Material {
-private:
-    double m_refractive_index;
+    // Solid angle pdf of scatter picking direction. Zero for materials that
+    // only scatter into a few directions, which light sampling cannot reach.
+    // Otherwise attenuation * pdf is the BSDF times the cosine.
+    double scatteringPdf(const Ray &ray, const HitInfo &info, const vector &direction) const {
+        if (m_type != MaterialType::lambertian) return 0.0;
 
-    static double reflectance(double cos, double ratio) {
-        // Use Schlick's approximation for reflectance
-        double r0 = pow((1.0 - ratio) / (1.0 + ratio), 2);
+        double cos = dot(facingNormal(ray, info), direction) / direction.norm();
 
-        return r0 + (1.0 - r0) * pow(1.0 - std::fabs(cos), 5);
+        return cosine_hemisphere_pdf(cos);
     }
 
+    ~Material() = default;
+};
+
+
+class LightSource: public Material {
 public:
-    Dielectric() : Material() {
-        m_refractive_index = 1.0;
-    }
+    LightSource() : Material(MaterialType::light, nullptr) {}
 
-    Dielectric(std::shared_ptr<Texture> t_texture, double t_refractive_index) : Material(t_texture) {
-        m_refractive_index = t_refractive_index;
-    }
+    LightSource(const Texture * t_texture) : Material(MaterialType::light, t_texture) {}
 
-    double getRefractiveIndex() const { return m_refractive_index; }
+    ~LightSource() = default;
+};
 
-    bool scatter(const Ray &ray, HitInfo &info, color &attenuation, Ray &scattered) const override {
-        double cos = dot(ray.getDirection(), info.normal);
-        double sin = std::sqrt(1.0 - cos * cos);
 
-        double ratio = (cos < 0.0) ?  1.0 / m_refractive_index : m_refractive_index;
+class Lambertian: public Material {
+public:
+    Lambertian() : Material(MaterialType::lambertian, nullptr) {}
 
-        if (ratio * sin > 1.0 || random_double() < reflectance(cos, ratio)) {
-            vector reflected = ray.getDirection() -
-                2.0 * dot(ray.getDirection(), info.normal) * info.normal;
+    Lambertian(const Texture * t_texture) : Material(MaterialType::lambertian, t_texture) {}
 
-            scattered = Ray(
-                info.hit_point, reflected + random_unit_vector());
+    ~Lambertian() = default;
+};
 
-        } else {
-            vector perp = ratio * (ray.getDirection() - cos * info.normal);
-            vector paral = std::sqrt(1.0 - perp.squared_norm()) * info.normal;
 
-            scattered = Ray(
-                info.hit_point, (cos < 0.0) ? perp - paral : perp + paral);
-        }
+class Metal: public Material {
+public:
+    Metal() : Material(MaterialType::metal, nullptr, 0.2) {}
 
-        attenuation = getTexture()->getColorInTexture(
-            info.texture_u, info.texture_v, info.hit_point);
+    // Fuzzy is the alpha of the GGX distribution. It used to be the radius of
+    // the sphere the reflection was jittered in, so scenes written for that
+    // blur differently with the same value.
+    Metal(const Texture * t_texture, double t_fuzzy) : Material(MaterialType::metal, t_texture, t_fuzzy) {}
 
-        return true;
-    }
+    double getFuzzy() const { return getParameter(); }
+
+    ~Metal() = default;
+};
+
+
+class Dielectric: public Material {
+public:
+    Dielectric() : Material(MaterialType::dielectric, nullptr, 1.0) {}
+
+    Dielectric(const Texture * t_texture, double t_refractive_index) :
+        Material(MaterialType::dielectric, t_texture, t_refractive_index) {}
+
+    double getRefractiveIndex() const { return getParameter(); }
 
     ~Dielectric() = default;
 };
@@ -0,0 +1,314 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "hittable.hpp"
+#include "bvh_tree.hpp"
+#include "wide_bvh.hpp"
+#include "mapped_file.hpp"
+
+
+// Ray data for the watertight triangle test of Woop, Benthin and Wald (2013).
+// The ray is sheared so it points along +z, then every edge test is a 2D
+// cross product that neighbouring triangles evaluate identically.
+struct WatertightRay {
+    point origin;
+
+    int kx, ky, kz;
+    double shear_x, shear_y, shear_z;
+
+    WatertightRay(const Ray &ray) {
+        origin = ray.getOrigin();
+        vector direction = ray.getDirection();
+
+        kz = 0;
+        if (std::fabs(direction[1]) > std::fabs(direction[kz])) kz = 1;
+        if (std::fabs(direction[2]) > std::fabs(direction[kz])) kz = 2;
+
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+
+        // Preserves the winding of the triangles
+        if (direction[kz] < 0.0) std::swap(kx, ky);
+
+        shear_x = direction[kx] / direction[kz];
+        shear_y = direction[ky] / direction[kz];
+        shear_z = 1.0 / direction[kz];
+    }
+};
+
+
+// Indexed triangle mesh. Vertex attributes live in flat float buffers shared
+// by all triangles, and a triangle is nothing more than three indices. The
+// buffers are either owned by the mesh or used in place in a mapped file.
+class TriangleMesh: public Hittable {
+private:
+    std::vector<float> m_position_storage;
+    std::vector<float> m_normal_storage;
+    std::vector<float> m_uv_storage;
+    std::vector<uint32_t> m_index_storage;
+
+    // Keeps the file of a mapped mesh open for as long as the mesh lives
+    std::shared_ptr<MappedFile> m_file;
+
+    const float * m_positions = nullptr;   // xyz per vertex
+    const float * m_normals = nullptr;     // xyz per vertex, or null
+    const float * m_uvs = nullptr;         // uv per vertex, or null
+    const uint32_t * m_indices = nullptr;  // Three per triangle, in BVH leaf order
+
+    int m_vertex_count = 0;
+    int m_triangle_count = 0;
+
+    WideBVHTree m_tree;
+    AABB m_bounds;
+
+    // Triangles are cheap enough to test a few at a time in one leaf
+    static const int leaf_size = 4;
+
+    point vertex(uint32_t index) const {
+        return point(
+            m_positions[3 * index + 0],
+            m_positions[3 * index + 1],
+            m_positions[3 * index + 2]);
+    }
+
+    // Returns the distance and barycentric weights of the hit, if any
+    bool intersectTriangle(
+        const WatertightRay &ray, int triangle, double t_max,
+        double &t, double &b0, double &b1, double &b2) const {
+
+        point v0 = vertex(m_indices[3 * triangle + 0]) - ray.origin;
+        point v1 = vertex(m_indices[3 * triangle + 1]) - ray.origin;
+        point v2 = vertex(m_indices[3 * triangle + 2]) - ray.origin;
+
+        double ax = v0[ray.kx] - ray.shear_x * v0[ray.kz];
+        double ay = v0[ray.ky] - ray.shear_y * v0[ray.kz];
+        double bx = v1[ray.kx] - ray.shear_x * v1[ray.kz];
+        double by = v1[ray.ky] - ray.shear_y * v1[ray.kz];
+        double cx = v2[ray.kx] - ray.shear_x * v2[ray.kz];
+        double cy = v2[ray.ky] - ray.shear_y * v2[ray.kz];
+
+        double u = cx * by - cy * bx;
+        double v = ax * cy - ay * cx;
+        double w = bx * ay - by * ax;
+
+        if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0))
+            return false;
+
+        double det = u + v + w;
+        if (det == 0.0) return false;
+
+        double scaled_t =
+            u * ray.shear_z * v0[ray.kz] +
+            v * ray.shear_z * v1[ray.kz] +
+            w * ray.shear_z * v2[ray.kz];
+
+        double inv_det = 1.0 / det;
+        t = scaled_t * inv_det;
+
+        if (t < 0.001 || t >= t_max) return false;
+
+        b0 = u * inv_det;
+        b1 = v * inv_det;
+        b2 = w * inv_det;
+
+        return true;
+    }
+
+public:
+    TriangleMesh() : Hittable() {}
+
+    // Empty normals or uvs mean the file had none. A width of 0 picks the
+    // widest BVH layout the CPU supports.
+    TriangleMesh(
+        std::vector<float> t_positions, std::vector<float> t_normals,
+        std::vector<float> t_uvs, std::vector<uint32_t> t_indices,
+        const Material * t_material, int t_width = 0) : Hittable(t_material) {
+
+        m_position_storage = std::move(t_positions);
+        m_normal_storage = std::move(t_normals);
+        m_uv_storage = std::move(t_uvs);
+        m_index_storage = std::move(t_indices);
+
+        m_positions = m_position_storage.data();
+        m_normals = m_normal_storage.empty() ? nullptr : m_normal_storage.data();
+        m_uvs = m_uv_storage.empty() ? nullptr : m_uv_storage.data();
+        m_indices = m_index_storage.data();
+
+        m_vertex_count = static_cast<int>(m_position_storage.size() / 3);
+        m_triangle_count = static_cast<int>(m_index_storage.size() / 3);
+
+        buildTree(t_width);
+    }
+
+    // Uses buffers and BVH nodes that live in t_file, without copying them.
+    // The indices must already be in the leaf order of the nodes.
+    TriangleMesh(
+        std::shared_ptr<MappedFile> t_file,
+        const float * t_positions, const float * t_normals, const float * t_uvs, int t_vertex_count,
+        const uint32_t * t_indices, int t_triangle_count, const AABB &t_bounds,
+        int t_width, const void * t_nodes, int t_node_count,
+        const Material * t_material) : Hittable(t_material) {
+
+        m_file = t_file;
+
+        m_positions = t_positions;
+        m_normals = t_normals;
+        m_uvs = t_uvs;
+        m_indices = t_indices;
+
+        m_vertex_count = t_vertex_count;
+        m_triangle_count = t_triangle_count;
+
+        m_bounds = t_bounds;
+        m_tree.view(t_width, t_nodes, t_node_count);
+    }
+
+    // The buffer pointers would dangle in a copy
+    TriangleMesh(const TriangleMesh &) = delete;
+    TriangleMesh &operator=(const TriangleMesh &) = delete;
+
+    // Builds the per-mesh BVH and stores the triangles in its leaf order
+    void buildTree(int t_width = 0) {
+        int count = getTriangleCount();
+
+        std::vector<AABB> bounds(count);
+        m_bounds = AABB();
+
+        for (int i = 0; i < count; i++) {
+            AABB box = AABB(vertex(m_indices[3 * i]), vertex(m_indices[3 * i + 1]));
+            box.expand(vertex(m_indices[3 * i + 2]));
+
+            bounds[i] = box;
+            m_bounds.expand(box);
+        }
+
+        BVHTree tree = BVHTree(bounds);
+
+        std::vector<uint32_t> ordered(3 * static_cast<size_t>(count));
+        const std::vector<int> &order = tree.getIndices();
+
+        for (int i = 0; i < count; i++) {
+            for (int corner = 0; corner < 3; corner++)
+                ordered[3 * i + corner] = m_indices[3 * order[i] + corner];
+        }
+
+        m_index_storage.swap(ordered);
+        m_indices = m_index_storage.data();
+
+        // The binary tree is only needed until it is collapsed
+        m_tree.build(tree, t_width, leaf_size);
+    }
+
+    int getVertexCount() const { return m_vertex_count; }
+
+    int getTriangleCount() const { return m_triangle_count; }
+
+    const float * getPositions() const { return m_positions; }
+
+    const float * getNormals() const { return m_normals; }
+
+    const float * getUVs() const { return m_uvs; }
+
+    const uint32_t * getIndices() const { return m_indices; }
+
+    const WideBVHTree &getTree() const { return m_tree; }
+
+    bool isMapped() const { return m_file != nullptr; }
+
+    AABB boundingBox() const override { return m_bounds; }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        WatertightRay watertight = WatertightRay(ray);
+
+        int closest = -1;
+        double weights[3];
+
+        double root = std::numeric_limits<double>::infinity();
+
+        auto intersect = [&](int position, double &t_max) {
+            double t, b0, b1, b2;
+
+            if (!intersectTriangle(watertight, position, t_max, t, b0, b1, b2))
+                return false;
+
+            t_max = root = t;
+            closest = position;
+
+            weights[0] = b0;
+            weights[1] = b1;
+            weights[2] = b2;
+
+            return true;
+        };
+
+        m_tree.traverse(ray, root, intersect);
+
+        if (closest == -1) return false;
+
+        uint32_t i0 = m_indices[3 * closest + 0];
+        uint32_t i1 = m_indices[3 * closest + 1];
+        uint32_t i2 = m_indices[3 * closest + 2];
+
+        point p0 = vertex(i0);
+        point p1 = vertex(i1);
+        point p2 = vertex(i2);
+
+        info.root = root;
+        info.hit_point = ray.at(root);
+        info.material = getMaterial();
+
+        if (!m_normals) {
+            info.normal = normalize(cross(p1 - p0, p2 - p0));
+
+        } else {
+            vector normal;
+
+            for (int corner = 0; corner < 3; corner++) {
+                uint32_t index = m_indices[3 * closest + corner];
+
+                normal += weights[corner] * vector(
+                    m_normals[3 * index + 0],
+                    m_normals[3 * index + 1],
+                    m_normals[3 * index + 2]);
+            }
+
+            // Corners without a normal in the file are stored as zero
+            info.normal = (normal.squared_norm() > 0.0) ?
+                normalize(normal) : normalize(cross(p1 - p0, p2 - p0));
+        }
+
+        if (!m_uvs) {
+            info.texture_u = weights[1];
+            info.texture_v = weights[2];
+
+        } else {
+            info.texture_u =
+                weights[0] * m_uvs[2 * i0] + weights[1] * m_uvs[2 * i1] + weights[2] * m_uvs[2 * i2];
+            info.texture_v =
+                weights[0] * m_uvs[2 * i0 + 1] + weights[1] * m_uvs[2 * i1 + 1] + weights[2] * m_uvs[2 * i2 + 1];
+        }
+
+        return true;
+    }
+
+    bool occluded(const Ray &ray, double t_max) const override {
+        WatertightRay watertight = WatertightRay(ray);
+
+        auto intersect = [&](int position, double &t_max) {
+            double t, b0, b1, b2;
+            return intersectTriangle(watertight, position, t_max, t, b0, b1, b2);
+        };
+
+        return m_tree.occluded(ray, t_max, intersect);
+    }
+
+    ~TriangleMesh() = default;
+};
+
+#endif
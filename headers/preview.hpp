@@ -0,0 +1,116 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handler.hpp"
+
+
+// Writes preview images on a thread of its own, so the render never waits
+// for an image to be encoded. Only the latest snapshot is kept: one that
+// comes in while another is still being written replaces the one waiting.
+class PreviewWriter {
+private:
+    std::string m_filename;
+    int m_width, m_height;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+
+    std::vector<color> m_pending;
+    bool m_has_pending = false;
+    bool m_stopping = false;
+
+    int m_written = 0;
+
+    // Writes next to the target and renames, so viewers never see half an image
+    void write(const std::vector<color> &pixels) {
+        std::string temporary = m_filename + ".tmp";
+
+        {
+            ImageHandler handler = ImageHandler(m_width, m_height, temporary);
+
+            for (const color &pixel: pixels)
+                handler.putPixel(pixel);
+        }
+
+        if (std::rename(temporary.c_str(), m_filename.c_str()) != 0)
+            std::cerr << "ERROR: could not write the preview " << m_filename << std::endl;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            m_condition.wait(lock, [&] { return m_has_pending || m_stopping; });
+
+            if (!m_has_pending) return;
+
+            std::vector<color> pixels;
+            pixels.swap(m_pending);
+            m_has_pending = false;
+
+            lock.unlock();
+            write(pixels);
+            lock.lock();
+
+            m_written++;
+        }
+    }
+
+public:
+    PreviewWriter(const std::string &t_filename, int t_width, int t_height) {
+        m_filename = t_filename;
+        m_width = t_width;
+        m_height = t_height;
+
+        m_thread = std::thread(&PreviewWriter::run, this);
+    }
+
+    PreviewWriter(const PreviewWriter &) = delete;
+    PreviewWriter &operator=(const PreviewWriter &) = delete;
+
+    // Takes the pixels, row by row and ready to display, and returns at once
+    void submit(std::vector<color> t_pixels) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_pending.swap(t_pixels);
+            m_has_pending = true;
+        }
+
+        m_condition.notify_one();
+    }
+
+    // Previews written so far
+    int getWrittenCount() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_written;
+    }
+
+    // Writes the snapshot still waiting, if any, and stops the thread
+    void finish() {
+        if (!m_thread.joinable()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+
+        m_condition.notify_one();
+        m_thread.join();
+    }
+
+    ~PreviewWriter() {
+        finish();
+    }
+};
+
+#endif
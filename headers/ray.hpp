@@ -2,28 +2,32 @@
 #define RAY_H
 
 
-class Ray {
+template <typename T>
+class BasicRay {
 private:
-    point m_origin;
-    vector m_direction;
+    basic_vector<T> m_origin;
+    basic_vector<T> m_direction;
 
 public:
-    Ray() {}
+    BasicRay() {}
 
-    Ray(const point &t_origin, const vector &t_direction) {
+    BasicRay(const basic_vector<T> &t_origin, const basic_vector<T> &t_direction) {
         m_origin = t_origin;
         m_direction = normalize(t_direction);
     }
 
-    point getOrigin() const { return m_origin; }
+    basic_vector<T> getOrigin() const { return m_origin; }
 
-    vector getDirection() const { return m_direction; }
+    basic_vector<T> getDirection() const { return m_direction; }
 
-    point at(double t) const {
+    basic_vector<T> at(T t) const {
         return m_origin + t * m_direction;
     }
 
-    ~Ray() = default;
+    ~BasicRay() = default;
 };
 
+
+using Ray = BasicRay<real>;
+
 #endif
@@ -0,0 +1,289 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+#include "vector.hpp"
+#include "utils.hpp"
+#include "sampling.hpp"
+
+
+// Source of the random numbers of a path. A sample is a point in a space
+// of many dimensions, and every call takes the next ones, so that each
+// decision along the path, from the pixel jitter to the last scatter, gets
+// a dimension of its own. Samplers differ in how the samples of a pixel
+// cover each dimension.
+class Sampler {
+protected:
+    uint64_t m_seed = 0;
+    uint64_t m_pixel = 0;
+    uint32_t m_index = 0;
+    uint32_t m_dimension = 0;
+
+    uint64_t m_pixel_hash = 0;   // Of the seed and the pixel
+
+    // Bits that are unrelated for every pixel and dimension
+    uint64_t dimensionHash() const { return splitmix64(m_pixel_hash + m_dimension); }
+
+public:
+    Sampler() {}
+
+    void setSeed(uint64_t t_seed) {
+        m_seed = t_seed;
+        m_pixel_hash = 0;
+    }
+
+    // Starts sample t_index of t_pixel, back at its first dimension
+    virtual void startSample(uint64_t t_pixel, uint32_t t_index) {
+        if (t_pixel != m_pixel || m_pixel_hash == 0)
+            m_pixel_hash = splitmix64(m_seed ^ splitmix64(t_pixel)) | 1;
+
+        m_pixel = t_pixel;
+        m_index = t_index;
+        m_dimension = 0;
+    }
+
+    // Uniform in [0, 1)
+    virtual double get1D() = 0;
+
+    // Two dimensions that are stratified together, as for a point on a square
+    virtual void get2D(double &u, double &v) = 0;
+
+    // Samplers keep per-sample state, so each thread works on a copy
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+
+    virtual ~Sampler() = default;
+};
+
+
+// Plain random numbers: the error falls as 1 / sqrt(n) at best
+class IndependentSampler: public Sampler {
+private:
+    RNG m_rng;
+
+public:
+    IndependentSampler() : Sampler() {}
+
+    void startSample(uint64_t t_pixel, uint32_t t_index) override {
+        Sampler::startSample(t_pixel, t_index);
+
+        m_rng = RNG(splitmix64(m_seed) ^ t_index, t_pixel);
+    }
+
+    double get1D() override { return m_rng.nextDouble(); }
+
+    void get2D(double &u, double &v) override {
+        u = m_rng.nextDouble();
+        v = m_rng.nextDouble();
+    }
+
+    std::unique_ptr<Sampler> clone() const override {
+        return std::make_unique<IndependentSampler>(*this);
+    }
+
+    ~IndependentSampler() = default;
+};
+
+
+// Random permutation of [0, count) picked by seed (Kensler, 2013)
+inline uint32_t permute(uint32_t index, uint32_t count, uint32_t seed) {
+    uint32_t mask = count - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+
+    // Cycle-walks until the value lands below count
+    do {
+        index ^= seed;             index *= 0xe170893d;
+        index ^= seed >> 16;       index ^= (index & mask) >> 4;
+        index ^= seed >> 8;        index *= 0x0929eb3f;
+        index ^= seed >> 23;       index ^= (index & mask) >> 1;
+        index *= 1 | seed >> 27;   index *= 0x6935fa69;
+        index ^= (index & mask) >> 11;
+        index *= 0x74dcb303;       index ^= (index & mask) >> 2;
+        index *= 0x9e501cc3;       index ^= (index & mask) >> 2;
+        index *= 0xc860a3df;       index &= mask;
+        index ^= index >> 5;
+    } while (index >= count);
+
+    return (index + seed) % count;
+}
+
+
+// Splits every dimension into m_strata intervals, and every pair into a
+// grid when m_strata is a square. Each group of m_strata consecutive samples
+// puts one sample in each stratum, in an order shuffled per dimension so
+// that the dimensions are not correlated.
+class StratifiedSampler: public Sampler {
+private:
+    uint32_t m_strata;
+    uint32_t m_side;   // Of the 2D grid, or 0 when m_strata is not a square
+
+    RNG m_rng;         // Jitter inside the strata
+
+    uint32_t stratum() const {
+        uint32_t group = m_index / m_strata;
+
+        return permute(m_index % m_strata, m_strata, static_cast<uint32_t>(dimensionHash()) ^ group * 0x9E3779B9u);
+    }
+
+public:
+    StratifiedSampler(int t_strata = 64) : Sampler() {
+        m_strata = (t_strata > 0) ? static_cast<uint32_t>(t_strata) : 1;
+
+        m_side = 0;
+        while ((m_side + 1) * (m_side + 1) <= m_strata) m_side++;
+        if (m_side * m_side != m_strata) m_side = 0;
+    }
+
+    void startSample(uint64_t t_pixel, uint32_t t_index) override {
+        Sampler::startSample(t_pixel, t_index);
+
+        m_rng = RNG(splitmix64(m_seed) ^ t_index, t_pixel);
+    }
+
+    double get1D() override {
+        double value = (stratum() + m_rng.nextDouble()) / m_strata;
+        m_dimension++;
+
+        return value;
+    }
+
+    void get2D(double &u, double &v) override {
+        if (m_side == 0) {
+            u = get1D();
+            v = get1D();
+
+            return;
+        }
+
+        uint32_t cell = stratum();
+        m_dimension += 2;
+
+        u = (cell % m_side + m_rng.nextDouble()) / m_side;
+        v = (cell / m_side + m_rng.nextDouble()) / m_side;
+    }
+
+    std::unique_ptr<Sampler> clone() const override {
+        return std::make_unique<StratifiedSampler>(*this);
+    }
+
+    ~StratifiedSampler() = default;
+};
+
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+
+    return x;
+}
+
+// Hash of Laine and Karras, as improved by Burley (2020). Each bit only
+// depends on the bits below it, so on a bit-reversed value it is an Owen
+// scramble: each digit flips depending on the digits above it, which keeps
+// the stratification of the Sobol points.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+
+    return x;
+}
+
+
+// Owen-scrambled Sobol points. Every pair of dimensions uses the first two
+// Sobol dimensions, which are stratified together in all power of two
+// grids, with the sample order shuffled and the values scrambled anew for
+// each pair (Burley, 2020). The error falls close to 1 / n on smooth pixels,
+// best with power of two sample counts.
+//
+// Values are kept bit-reversed, the order in which the scramble works, so
+// that only one reversal per value is left.
+class SobolSampler: public Sampler {
+private:
+    uint32_t m_reversed_index = 0;
+
+    static double toUnit(uint32_t x) { return x * (1.0 / 4294967296.0); }
+
+    // Bit reversal of the second Sobol dimension, whose direction numbers
+    // are the rows of Pascal's triangle modulo 2. The first dimension is
+    // the bit reversal of the index, so it is the index itself here.
+    static uint32_t sobolSecondReversed(uint32_t index) {
+        uint32_t result = 0;
+
+        for (uint32_t direction = 1; index; index >>= 1, direction ^= direction << 1) {
+            if (index & 1) result ^= direction;
+        }
+
+        return result;
+    }
+
+    // Shuffles the order of the samples, in the same way for a whole pair
+    uint32_t shuffledIndex(uint32_t seed) const {
+        return reverse_bits(laine_karras_permutation(m_reversed_index, seed));
+    }
+
+public:
+    SobolSampler() : Sampler() {}
+
+    void startSample(uint64_t t_pixel, uint32_t t_index) override {
+        Sampler::startSample(t_pixel, t_index);
+
+        m_reversed_index = reverse_bits(t_index);
+    }
+
+    double get1D() override {
+        uint64_t hash = dimensionHash();
+        m_dimension++;
+
+        uint32_t index = shuffledIndex(static_cast<uint32_t>(hash));
+
+        return toUnit(reverse_bits(laine_karras_permutation(index, static_cast<uint32_t>(hash >> 32))));
+    }
+
+    void get2D(double &u, double &v) override {
+        uint64_t hash = dimensionHash();
+        uint64_t other_hash = splitmix64(hash);
+        m_dimension += 2;
+
+        uint32_t index = shuffledIndex(static_cast<uint32_t>(hash));
+
+        u = toUnit(reverse_bits(laine_karras_permutation(index, static_cast<uint32_t>(hash >> 32))));
+        v = toUnit(reverse_bits(laine_karras_permutation(sobolSecondReversed(index), static_cast<uint32_t>(other_hash))));
+    }
+
+    std::unique_ptr<Sampler> clone() const override {
+        return std::make_unique<SobolSampler>(*this);
+    }
+
+    ~SobolSampler() = default;
+};
+
+
+inline double random_double(Sampler &sampler) {
+    return sampler.get1D();
+}
+
+inline double random_double(Sampler &sampler, double min, double max) {
+    return min + (max - min) * sampler.get1D();
+}
+
+// Uniform over the sphere, from one 2D sample
+inline vector random_unit_vector(Sampler &sampler) {
+    double u, v;
+    sampler.get2D(u, v);
+
+    return sample_uniform_sphere(u, v);
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cmath>
+
+#include "vector.hpp"
+#include "utils.hpp"
+
+
+// Warps of a uniform point (u, v) of the unit square into directions, each
+// with its pdf over solid angle. Directions are local, around +z, and an ONB
+// takes them to the world. None of them calls a trigonometric function.
+
+
+// Orthonormal basis around a unit vector, without branches or a
+// normalization (Duff et al., 2017)
+class ONB {
+private:
+    vector m_u;
+    vector m_v;
+    vector m_w;
+
+public:
+    ONB(const vector &t_normal) {
+        double sign = std::copysign(1.0, t_normal.z());
+        double a = -1.0 / (sign + t_normal.z());
+        double b = t_normal.x() * t_normal.y() * a;
+
+        m_u = vector(1.0 + sign * t_normal.x() * t_normal.x() * a, sign * b, -sign * t_normal.x());
+        m_v = vector(b, sign + t_normal.y() * t_normal.y() * a, -t_normal.y());
+        m_w = t_normal;
+    }
+
+    const vector &getU() const { return m_u; }
+
+    const vector &getV() const { return m_v; }
+
+    const vector &getW() const { return m_w; }
+
+    vector toWorld(const vector &t_local) const {
+        return t_local.x() * m_u + t_local.y() * m_v + t_local.z() * m_w;
+    }
+
+    ~ONB() = default;
+};
+
+
+// Sine and cosine of tau * turns, for turns in [0, 1]. The angle is
+// brought within pi / 4 of a multiple of pi / 2, where Taylor polynomials
+// are accurate to 1e-11, then rotated back by that multiple.
+inline void sin_cos_turns(double turns, double &sin, double &cos) {
+    double quarters = std::nearbyint(4.0 * turns);
+    double x = (4.0 * turns - quarters) * (0.25 * tau);
+    double x2 = x * x;
+
+    double s = x * (1.0 + x2 * (-1.0 / 6.0 + x2 * (1.0 / 120.0 + x2 * (-1.0 / 5040.0 +
+        x2 * (1.0 / 362880.0 + x2 * (-1.0 / 39916800.0))))));
+    double c = 1.0 + x2 * (-0.5 + x2 * (1.0 / 24.0 + x2 * (-1.0 / 720.0 + x2 * (1.0 / 40320.0 +
+        x2 * (-1.0 / 3628800.0 + x2 * (1.0 / 479001600.0))))));
+
+    switch (static_cast<int>(quarters) & 3) {
+        case 0: sin = s;  cos = c;  break;
+        case 1: sin = c;  cos = -s; break;
+        case 2: sin = -s; cos = -c; break;
+        default: sin = -c; cos = s; break;
+    }
+}
+
+// Point at radius r and angle tau * v, lifted to height z
+inline vector polar_direction(double r, double z, double v) {
+    double sin, cos;
+    sin_cos_turns(v, sin, cos);
+
+    return vector(cos * r, sin * r, z);
+}
+
+// Uniform over the sphere: z is uniform in [-1, 1], as Archimedes showed
+inline vector sample_uniform_sphere(double u, double v) {
+    double z = 1.0 - 2.0 * u;
+
+    return polar_direction(std::sqrt(std::fmax(0.0, 1.0 - z * z)), z, v);
+}
+
+inline double uniform_sphere_pdf() {
+    return 1.0 / (2.0 * tau);
+}
+
+// Proportional to cos(theta): uniform on the disk, projected up (Malley)
+inline vector sample_cosine_hemisphere(double u, double v) {
+    return polar_direction(std::sqrt(u), std::sqrt(1.0 - u), v);
+}
+
+inline double cosine_hemisphere_pdf(double cos_theta) {
+    return (cos_theta > 0.0) ? cos_theta / pi : 0.0;
+}
+
+// Uniform over the cone around +z of the directions with cos(theta) above
+// 1 - one_minus_cos_max. Taking 1 - cos_max keeps narrow cones accurate.
+inline vector sample_uniform_cone(double u, double v, double one_minus_cos_max) {
+    double one_minus_cos = u * one_minus_cos_max;
+    double sin_squared = one_minus_cos * (2.0 - one_minus_cos);
+
+    return polar_direction(std::sqrt(std::fmax(0.0, sin_squared)), 1.0 - one_minus_cos, v);
+}
+
+inline double uniform_cone_pdf(double one_minus_cos_max) {
+    return 1.0 / (tau * one_minus_cos_max);
+}
+
+// Microfacet normal of the GGX distribution of roughness alpha, in
+// proportion to D(h) cos(theta_h). tan^2 is alpha^2 u / (1 - u), so cos and
+// sin come out of square roots.
+inline vector sample_ggx_normal(double u, double v, double alpha) {
+    double alpha_squared = alpha * alpha;
+    double denominator = 1.0 - u + alpha_squared * u;
+
+    double cos_squared = (1.0 - u) / denominator;
+    double sin_squared = alpha_squared * u / denominator;
+
+    return polar_direction(std::sqrt(sin_squared), std::sqrt(cos_squared), v);
+}
+
+inline double ggx_distribution(double cos_theta, double alpha) {
+    if (cos_theta <= 0.0) return 0.0;
+
+    double alpha_squared = alpha * alpha;
+    double d = cos_theta * cos_theta * (alpha_squared - 1.0) + 1.0;
+
+    return alpha_squared / (pi * d * d);
+}
+
+// Of the microfacet normal. A direction reflected about it has this pdf
+// divided by 4 |dot(outgoing, normal)|.
+inline double ggx_normal_pdf(double cos_theta, double alpha) {
+    return ggx_distribution(cos_theta, alpha) * cos_theta;
+}
+
+// Smith masking of the GGX distribution for a direction at cos_theta from the
+// normal: the share of the microfacets facing it that it sees
+inline double ggx_smith_g1(double cos_theta, double alpha) {
+    if (cos_theta <= 0.0) return 0.0;
+
+    double cos_squared = cos_theta * cos_theta;
+    double tan_squared = (1.0 - cos_squared) / cos_squared;
+
+    return 2.0 / (1.0 + std::sqrt(1.0 + alpha * alpha * tan_squared));
+}
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "hittable.hpp"
+#include "bvh_tree.hpp"
+#include "wide_bvh.hpp"
+
+
+// Eight spheres, one per lane, stored as structure of arrays so that one
+// AVX2 instruction works on a coordinate of all of them. Unused lanes have
+// a NaN radius, which no comparison accepts.
+struct alignas(32) SphereBlock {
+    float center[3][8];
+    float radius[8];
+    uint32_t material[8];
+};
+
+
+// Single precision ray for the block tests, the direction of unit length
+struct SphereRay {
+    float origin[3];
+    float direction[3];
+
+    float origin_norm;   // Scales the rounding error of the float test
+
+    SphereRay(const Ray &t_ray) {
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis] = static_cast<float>(t_ray.getOrigin()[axis]);
+            direction[axis] = static_cast<float>(t_ray.getDirection()[axis]);
+        }
+
+        origin_norm = static_cast<float>(t_ray.getOrigin().norm());
+    }
+};
+
+
+// The float test only proposes lanes for the double precision one, so it
+// lets through spheres that miss by less than its rounding error, which
+// grows with the radius and the distances involved. Without it, rays that
+// graze a sphere in double precision could miss it in float.
+const float sphere_slack = 16.0f * std::numeric_limits<float>::epsilon();
+
+
+// Lane of the nearest sphere of the block hit past the self-intersection
+// epsilon and before t_max, and its root; -1 when none is. Lanes set in
+// skipped are left out. The discriminant is r^2 minus the squared distance
+// from the centre to the line, which does not cancel the way b^2 - c does
+// for small or distant spheres.
+inline int nearest_in_block_scalar(const SphereBlock &block, const SphereRay &ray, float t_max, int skipped, float &t) {
+    int nearest = -1;
+
+    for (int lane = 0; lane < 8; lane++) {
+        if (skipped & (1 << lane)) continue;
+
+        float oc[3];
+        for (int axis = 0; axis < 3; axis++)
+            oc[axis] = block.center[axis][lane] - ray.origin[axis];
+
+        float projection = oc[0] * ray.direction[0] + oc[1] * ray.direction[1] + oc[2] * ray.direction[2];
+
+        float distance_squared = 0.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            float offset = oc[axis] - projection * ray.direction[axis];
+            distance_squared += offset * offset;
+        }
+
+        float oc_norm = std::sqrt(oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2]);
+        float slack = sphere_slack * block.radius[lane] * (oc_norm + ray.origin_norm);
+
+        float delta = block.radius[lane] * block.radius[lane] - distance_squared;
+        if (!(delta >= -slack)) continue;
+
+        float half_chord = std::sqrt(std::max(delta, 0.0f));
+        float root = (projection - half_chord > 0.001f) ? projection - half_chord : projection + half_chord;
+
+        if (root > 0.001f && root < t_max) {
+            t_max = root;
+            t = root;
+            nearest = lane;
+        }
+    }
+
+    return nearest;
+}
+
+
+#ifdef RT_X86
+
+TARGET_AVX2
+inline int nearest_in_block_avx2(const SphereBlock &block, const SphereRay &ray, float t_max, int skipped, float &t) {
+    __m256 oc[3];
+    __m256 direction[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        oc[axis] = _mm256_sub_ps(_mm256_load_ps(block.center[axis]), _mm256_set1_ps(ray.origin[axis]));
+        direction[axis] = _mm256_set1_ps(ray.direction[axis]);
+    }
+
+    __m256 projection = _mm256_mul_ps(oc[0], direction[0]);
+    projection = _mm256_fmadd_ps(oc[1], direction[1], projection);
+    projection = _mm256_fmadd_ps(oc[2], direction[2], projection);
+
+    __m256 distance_squared = _mm256_setzero_ps();
+    __m256 oc_squared = _mm256_setzero_ps();
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m256 offset = _mm256_fnmadd_ps(projection, direction[axis], oc[axis]);
+        distance_squared = _mm256_fmadd_ps(offset, offset, distance_squared);
+        oc_squared = _mm256_fmadd_ps(oc[axis], oc[axis], oc_squared);
+    }
+
+    __m256 radius = _mm256_load_ps(block.radius);
+    __m256 delta = _mm256_fmsub_ps(radius, radius, distance_squared);
+
+    __m256 reach = _mm256_add_ps(_mm256_sqrt_ps(oc_squared), _mm256_set1_ps(ray.origin_norm));
+    __m256 slack = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(sphere_slack), radius), reach);
+
+    __m256 half_chord = _mm256_sqrt_ps(_mm256_max_ps(delta, _mm256_setzero_ps()));
+    __m256 epsilon = _mm256_set1_ps(0.001f);
+
+    __m256 near_root = _mm256_sub_ps(projection, half_chord);
+    __m256 far_root = _mm256_add_ps(projection, half_chord);
+    __m256 root = _mm256_blendv_ps(far_root, near_root, _mm256_cmp_ps(near_root, epsilon, _CMP_GT_OQ));
+
+    __m256 valid = _mm256_and_ps(
+        _mm256_cmp_ps(delta, _mm256_sub_ps(_mm256_setzero_ps(), slack), _CMP_GE_OQ),
+        _mm256_and_ps(
+            _mm256_cmp_ps(root, epsilon, _CMP_GT_OQ),
+            _mm256_cmp_ps(root, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+
+    // Lane i is kept when bit i of skipped is clear
+    __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i skipped_bits = _mm256_and_si256(_mm256_set1_epi32(skipped), lane_bits);
+
+    valid = _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpeq_epi32(skipped_bits, _mm256_setzero_si256())));
+
+    if (_mm256_movemask_ps(valid) == 0) return -1;
+
+    // Minimum over the lanes, then the first lane that holds it
+    root = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), root, valid);
+
+    __m256 minimum = _mm256_min_ps(root, _mm256_permute2f128_ps(root, root, 1));
+    minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+    minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    t = _mm256_cvtss_f32(minimum);
+
+    return lowest_set_bit(_mm256_movemask_ps(_mm256_and_ps(valid, _mm256_cmp_ps(root, minimum, _CMP_EQ_OQ))));
+}
+
+#endif
+
+
+// Many spheres as a single primitive, for particle-like scenes. Spheres are
+// packed eight to a block in the order of a BVH over them, so each block
+// holds neighbours, and a wide BVH over the blocks finds the ones a ray
+// meets. A block is tested in one AVX2 step, or lane by lane without AVX2,
+// and the nearest hit is refined in double precision.
+class SphereSet: public Hittable {
+private:
+    std::vector<SphereBlock> m_blocks;
+    std::vector<const Material *> m_materials;
+
+    int m_sphere_count = 0;
+
+    WideBVHTree m_tree;
+    AABB m_bounds;
+
+    // Blocks sit in BVH leaf order, one to a leaf
+    static const int leaf_size = 1;
+
+    static AABB blockBounds(const SphereBlock &block) {
+        AABB box;
+
+        for (int lane = 0; lane < 8; lane++) {
+            if (std::isnan(block.radius[lane])) continue;
+
+            point center = point(block.center[0][lane], block.center[1][lane], block.center[2][lane]);
+            vector radius = vector(block.radius[lane], block.radius[lane], block.radius[lane]);
+
+            box.expand(AABB(center - radius, center + radius));
+        }
+
+        return box;
+    }
+
+    int nearestInBlock(const SphereBlock &block, const SphereRay &ray, float t_max, int skipped, float &t) const {
+#ifdef RT_X86
+        if (cpu_supports_avx2()) return nearest_in_block_avx2(block, ray, t_max, skipped, t);
+#endif
+        return nearest_in_block_scalar(block, ray, t_max, skipped, t);
+    }
+
+    // Double precision root of one sphere, as Sphere::intersect finds it
+    static bool refine(const Ray &ray, const point &center, double radius, double &root) {
+        vector oc = ray.getOrigin() - center;
+
+        double b = dot(ray.getDirection(), oc);
+        double c = oc.squared_norm() - radius * radius;
+
+        double delta = b * b - c;
+        if (delta < 0.0) return false;
+
+        double sqrt_delta = std::sqrt(delta);
+        root = -b - sqrt_delta;
+
+        if (root < 0.001) {
+            root = -b + sqrt_delta;
+            if (root < 0.001) return false;
+        }
+
+        return true;
+    }
+
+    // Lane of the nearest sphere of the block whose double precision root
+    // lies past the epsilon and before t_max, or -1. The float test only
+    // proposes lanes: one that refine turns down is left out and the block
+    // is tested again, so the spheres behind it are not missed.
+    int nearestRefined(const SphereBlock &block, const Ray &ray, const SphereRay &sphere_ray, double t_max, double &root) const {
+        int skipped = 0;
+
+        while (true) {
+            float t;
+            int lane = nearestInBlock(block, sphere_ray, static_cast<float>(t_max) * wide_far_scale, skipped, t);
+            if (lane < 0) return -1;
+
+            point center = point(block.center[0][lane], block.center[1][lane], block.center[2][lane]);
+
+            if (refine(ray, center, block.radius[lane], root) && root < t_max) return lane;
+
+            skipped |= 1 << lane;
+        }
+    }
+
+public:
+    SphereSet() : Hittable() {}
+
+    // Sphere i has material t_materials[t_material_ids[i]]. A width of 0
+    // picks the widest BVH layout the CPU supports.
+    SphereSet(
+        const std::vector<point> &t_centers, const std::vector<double> &t_radii,
+        const std::vector<int> &t_material_ids, std::vector<const Material *> t_materials,
+        int t_width = 0) : Hittable(t_materials.empty() ? nullptr : t_materials[0]) {
+
+        m_materials = std::move(t_materials);
+        m_sphere_count = static_cast<int>(t_centers.size());
+
+        // Neighbouring spheres end up in the same block
+        std::vector<AABB> sphere_bounds(m_sphere_count);
+
+        for (int i = 0; i < m_sphere_count; i++) {
+            vector radius = vector(t_radii[i], t_radii[i], t_radii[i]);
+            sphere_bounds[i] = AABB(t_centers[i] - radius, t_centers[i] + radius);
+        }
+
+        BVHTree sphere_tree = BVHTree(sphere_bounds);
+        const std::vector<int> &order = sphere_tree.getIndices();
+
+        std::vector<SphereBlock> blocks((m_sphere_count + 7) / 8);
+
+        for (int position = 0; position < 8 * static_cast<int>(blocks.size()); position++) {
+            SphereBlock &block = blocks[position / 8];
+            int lane = position % 8;
+
+            if (position >= m_sphere_count) {
+                for (int axis = 0; axis < 3; axis++) block.center[axis][lane] = 0.0f;
+                block.radius[lane] = std::numeric_limits<float>::quiet_NaN();
+                block.material[lane] = 0;
+
+                continue;
+            }
+
+            int sphere = order[position];
+
+            for (int axis = 0; axis < 3; axis++)
+                block.center[axis][lane] = static_cast<float>(t_centers[sphere][axis]);
+
+            block.radius[lane] = static_cast<float>(t_radii[sphere]);
+            block.material[lane] = static_cast<uint32_t>(t_material_ids[sphere]);
+        }
+
+        // Then a BVH over the blocks, which are stored in its leaf order
+        std::vector<AABB> bounds(blocks.size());
+        m_bounds = AABB();
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+            bounds[i] = blockBounds(blocks[i]);
+            m_bounds.expand(bounds[i]);
+        }
+
+        BVHTree tree = BVHTree(bounds);
+
+        m_blocks.resize(blocks.size());
+        for (size_t i = 0; i < blocks.size(); i++)
+            m_blocks[i] = blocks[tree.getIndices()[i]];
+
+        m_tree.build(tree, t_width, leaf_size);
+    }
+
+    int getSphereCount() const { return m_sphere_count; }
+
+    int getBlockCount() const { return static_cast<int>(m_blocks.size()); }
+
+    AABB boundingBox() const override { return m_bounds; }
+
+    bool hit(const Ray &ray, HitInfo &info) const override {
+        SphereRay sphere_ray = SphereRay(ray);
+
+        const SphereBlock * closest_block = nullptr;
+        int closest_lane = -1;
+
+        double root = std::numeric_limits<double>::infinity();
+
+        auto intersect = [&](int position, double &t_max) {
+            const SphereBlock &block = m_blocks[position];
+
+            double refined;
+            int lane = nearestRefined(block, ray, sphere_ray, t_max, refined);
+            if (lane < 0) return false;
+
+            t_max = root = refined;
+            closest_block = &block;
+            closest_lane = lane;
+
+            return true;
+        };
+
+        m_tree.traverse(ray, root, intersect);
+
+        if (!closest_block) return false;
+
+        point center = point(
+            closest_block->center[0][closest_lane],
+            closest_block->center[1][closest_lane],
+            closest_block->center[2][closest_lane]);
+
+        info.root = root;
+        info.hit_point = ray.at(root);
+        info.normal = (info.hit_point - center) / closest_block->radius[closest_lane];
+        info.material = m_materials[closest_block->material[closest_lane]];
+
+        info.texture_u = atan2(info.normal.y(), info.normal.x()) / tau + 0.5;
+        info.texture_v = acos(std::fmax(-1.0, std::fmin(1.0, info.normal.z()))) / pi;
+
+        return true;
+    }
+
+    bool occluded(const Ray &ray, double t_max) const override {
+        SphereRay sphere_ray = SphereRay(ray);
+
+        // Accepts the same hits as hit, so shadows agree with what rays see
+        auto intersect = [&](int position, double &t_max) {
+            double root;
+            return nearestRefined(m_blocks[position], ray, sphere_ray, t_max, root) >= 0;
+        };
+
+        return m_tree.occluded(ray, t_max, intersect);
+    }
+
+    ~SphereSet() = default;
+};
+
+#endif
@@ -4,91 +4,106 @@
 #include "image.hpp"
 
 
-class Texture {
-public:
-    Texture() {}
-
-    virtual color getColorInTexture(double u, double v, const vector &t_hitpoint) const = 0;
+enum class TextureType { solid, checker, image };
 
-    ~Texture() = default;
-};
 
-
-class SolidTexture: public Texture {
+// Every kind of texture is this one class, told apart by its type, so that
+// looking up a colour is a switch the compiler can inline rather than a
+// virtual call. The classes below only pick the type and fill the fields it
+// uses; they must not add members of their own.
+class Texture {
 private:
-    color m_color;
-
-public:
-    SolidTexture() : Texture() {
-        m_color = color(0.5, 0.5, 0.5);
-    }
+    color m_color_odd;    // Also the colour of a solid texture
+    color m_color_even;
+    Image m_image;
 
-    SolidTexture(const color &t_color) {
-        m_color = t_color;
-    }
+    TextureType m_type;   // Last, in the padding the colours leave
 
-    color getColor() const { return m_color; }
+    color checkerColor(double u, double v) const {
+        int u_tmp = static_cast<int>(std::floor(12.0 * u));
+        int v_tmp = static_cast<int>(std::floor(12.0 * v));
 
-    color getColorInTexture(double u, double v, const vector &t_hitpoint) const override {
-        return m_color;
+        return ((u_tmp + v_tmp) % 2 == 0) ? m_color_even : m_color_odd;
     }
 
-    ~SolidTexture() = default;
-};
-
+    color imageColor(double u, double v) const {
+        int i = static_cast<int>(clamp(u) * m_image.getWidth());
+        int j = static_cast<int>(clamp(v) * m_image.getHeight());
 
-class CheckerTexture: public Texture {
-private:
-    color m_color_odd;
-    color m_color_even;
+        const unsigned char * pixel = m_image.pixelData(i, j);
 
-public:
-    CheckerTexture() : Texture() {
-        m_color_odd = color(0.8, 0.2, 0.2);
-        m_color_even = color(0.2, 0.2, 0.8);
+        return color(
+            pixel[0] / 255.0,
+            pixel[1] / 255.0,
+            pixel[2] / 255.0
+        );
     }
 
-    CheckerTexture(const color &t_color_odd, const color &t_color_even) {
+protected:
+    Texture(TextureType t_type, const color &t_color_odd = color(), const color &t_color_even = color()) : m_image() {
+        m_type = t_type;
         m_color_odd = t_color_odd;
         m_color_even = t_color_even;
     }
 
+    Texture(std::string t_filename) : m_image(t_filename) {
+        m_type = TextureType::image;
+    }
+
     color getColorOdd() const { return m_color_odd; }
 
     color getColorEven() const { return m_color_even; }
 
-    color getColorInTexture(double u, double v, const vector &t_hitpoint) const override {
-        int u_tmp = static_cast<int>(std::floor(12.0 * u));
-        int v_tmp = static_cast<int>(std::floor(12.0 * v));
-
-        return ((u_tmp + v_tmp) % 2 == 0) ? m_color_even : m_color_odd;
+public:
+    // The image would be freed twice
+    Texture(const Texture &) = delete;
+    Texture &operator=(const Texture &) = delete;
+
+    TextureType getType() const { return m_type; }
+
+    color getColorInTexture(double u, double v, const vector &t_hitpoint) const {
+        switch (m_type) {
+            case TextureType::checker: return checkerColor(u, v);
+            case TextureType::image: return imageColor(u, v);
+            default: return m_color_odd;
+        }
     }
 
-    ~CheckerTexture() = default;
+    ~Texture() = default;
 };
 
 
-class ImageTexture : public Texture {
-private:
-    Image m_image;
+class SolidTexture: public Texture {
+public:
+    SolidTexture() : SolidTexture(color(0.5, 0.5, 0.5)) {}
+
+    SolidTexture(const color &t_color) : Texture(TextureType::solid, t_color) {}
+
+    color getColor() const { return getColorOdd(); }
+
+    ~SolidTexture() = default;
+};
 
+
+class CheckerTexture: public Texture {
 public:
-    ImageTexture() : m_image() {}
+    CheckerTexture() : CheckerTexture(color(0.8, 0.2, 0.2), color(0.2, 0.2, 0.8)) {}
 
-    ImageTexture(std::string filename) : m_image(filename) {}
+    CheckerTexture(const color &t_color_odd, const color &t_color_even) :
+        Texture(TextureType::checker, t_color_odd, t_color_even) {}
 
-    color getColorInTexture(double u, double v, const vector &t_hitpoint) const override {
-        int i = static_cast<int>(clamp(u) * m_image.getWidth());
-        int j = static_cast<int>(clamp(v) * m_image.getHeight());
+    using Texture::getColorOdd;
+    using Texture::getColorEven;
 
-        const unsigned char * pixel = m_image.pixelData(i, j);
+    ~CheckerTexture() = default;
+};
 
-        return color(
-            pixel[0] / 255.0,
-            pixel[1] / 255.0,
-            pixel[2] / 255.0
-        );
-    }
+
+class ImageTexture : public Texture {
+public:
+    ImageTexture() : Texture(TextureType::image) {}
+
+    ImageTexture(std::string filename) : Texture(filename) {}
 
     ~ImageTexture() = default;
 };
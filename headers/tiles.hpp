@@ -0,0 +1,197 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Order in which the tiles of the image are handed out
+enum class TileOrder {
+    Scanline,   // Row by row
+    Hilbert,    // Along a Hilbert curve, so that neighbouring tiles run close in time
+    Spiral      // From the centre out, so the middle of the image is done first
+};
+
+
+// Splits the image into square tiles and lists its pixels tile by tile, in
+// the chosen order of tiles and row by row inside each tile
+class TileLayout {
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_tile_size = 32;
+    TileOrder m_order = TileOrder::Hilbert;
+
+    std::vector<int> m_pixels;   // In tile order
+    std::vector<int> m_tiles;    // Position of the tile of each pixel in that order
+
+    // Position of (x, y) along the Hilbert curve through a side by side grid,
+    // with side a power of two
+    static long long hilbertIndex(int side, int x, int y) {
+        long long index = 0;
+
+        for (int s = side / 2; s > 0; s /= 2) {
+            int rx = (x & s) > 0;
+            int ry = (y & s) > 0;
+
+            index += static_cast<long long>(s) * s * ((3 * rx) ^ ry);
+
+            // Rotates the quadrant so the curve inside it starts where it enters
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+
+                std::swap(x, y);
+            }
+        }
+
+        return index;
+    }
+
+    std::vector<int> orderTiles(int columns, int rows) const {
+        std::vector<int> tiles(columns * rows);
+        for (int tile = 0; tile < columns * rows; tile++) tiles[tile] = tile;
+
+        if (m_order == TileOrder::Hilbert) {
+            int side = 1;
+            while (side < std::max(columns, rows)) side *= 2;
+
+            std::vector<long long> keys(tiles.size());
+            for (int tile: tiles) keys[tile] = hilbertIndex(side, tile % columns, tile / columns);
+
+            std::sort(tiles.begin(), tiles.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+        }
+
+        if (m_order == TileOrder::Spiral) {
+            double centre_x = 0.5 * (columns - 1);
+            double centre_y = 0.5 * (rows - 1);
+
+            // Ring by ring, each ring clockwise from the top
+            auto ring = [&](int tile) {
+                return std::max(std::fabs(tile % columns - centre_x), std::fabs(tile / columns - centre_y));
+            };
+            auto angle = [&](int tile) {
+                return std::atan2(tile % columns - centre_x, centre_y - tile / columns);
+            };
+
+            std::stable_sort(tiles.begin(), tiles.end(), [&](int a, int b) {
+                double ring_a = ring(a), ring_b = ring(b);
+                return (ring_a != ring_b) ? ring_a < ring_b : angle(a) < angle(b);
+            });
+        }
+
+        return tiles;
+    }
+
+public:
+    TileLayout() {}
+
+    TileLayout(int t_width, int t_height, int t_tile_size, TileOrder t_order) {
+        m_width = t_width;
+        m_height = t_height;
+        m_tile_size = std::max(t_tile_size, 1);
+        m_order = t_order;
+
+        int columns = (m_width + m_tile_size - 1) / m_tile_size;
+        int rows = (m_height + m_tile_size - 1) / m_tile_size;
+
+        std::vector<int> tiles = orderTiles(columns, rows);
+
+        m_pixels.reserve(m_width * m_height);
+        m_tiles.resize(m_width * m_height);
+
+        for (int position = 0; position < static_cast<int>(tiles.size()); position++) {
+            int x0 = (tiles[position] % columns) * m_tile_size;
+            int y0 = (tiles[position] / columns) * m_tile_size;
+
+            for (int y = y0; y < std::min(y0 + m_tile_size, m_height); y++) {
+                for (int x = x0; x < std::min(x0 + m_tile_size, m_width); x++) {
+                    m_pixels.push_back(y * m_width + x);
+                    m_tiles[y * m_width + x] = position;
+                }
+            }
+        }
+    }
+
+    int getTileSize() const { return m_tile_size; }
+
+    TileOrder getOrder() const { return m_order; }
+
+    // Every pixel once, tile by tile
+    const std::vector<int> &getPixels() const { return m_pixels; }
+
+    int tileOf(int pixel) const { return m_tiles[pixel]; }
+
+    ~TileLayout() = default;
+};
+
+
+// Work items split among threads. Each thread starts on a contiguous share,
+// taking items from its front, and a thread that runs out steals from the
+// back of another share. Items are whole tiles, so a lock per share costs
+// nothing next to the work.
+class WorkQueues {
+private:
+    struct alignas(64) Share {
+        std::mutex mutex;
+        int begin = 0;
+        int end = 0;
+    };
+
+    std::unique_ptr<Share[]> m_shares;
+    int m_count = 0;
+
+public:
+    WorkQueues() {}
+
+    void reset(int t_items, int t_threads) {
+        if (t_threads != m_count) {
+            m_shares.reset(new Share[t_threads]);
+            m_count = t_threads;
+        }
+
+        for (int thread = 0; thread < m_count; thread++) {
+            m_shares[thread].begin = static_cast<int>(static_cast<long long>(t_items) * thread / m_count);
+            m_shares[thread].end = static_cast<int>(static_cast<long long>(t_items) * (thread + 1) / m_count);
+        }
+    }
+
+    // Next item for thread, its own if it has any left. False once every
+    // share is empty.
+    bool next(int thread, int &item, bool &stolen) {
+        {
+            Share &own = m_shares[thread];
+            std::lock_guard<std::mutex> lock(own.mutex);
+
+            if (own.begin < own.end) {
+                item = own.begin++;
+                stolen = false;
+
+                return true;
+            }
+        }
+
+        for (int offset = 1; offset < m_count; offset++) {
+            Share &victim = m_shares[(thread + offset) % m_count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+
+            if (victim.begin < victim.end) {
+                item = --victim.end;
+                stolen = true;
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    ~WorkQueues() = default;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "utils.hpp"
+#include "aabb.hpp"
+
+
+// Affine transform stored as a 3x4 matrix, together with its inverse
+class Transform {
+private:
+    double m_matrix[3][4];
+    double m_inverse[3][4];
+
+    static void multiply(const double a[3][4], const double b[3][4], double result[3][4]) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                result[i][j] =
+                    a[i][0] * b[0][j] +
+                    a[i][1] * b[1][j] +
+                    a[i][2] * b[2][j] +
+                    ((j == 3) ? a[i][3] : 0.0);
+            }
+        }
+    }
+
+    static point transformPoint(const double m[3][4], const point &p) {
+        return point(
+            m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+            m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+            m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    static vector transformVector(const double m[3][4], const vector &v) {
+        return vector(
+            m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+            m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+public:
+    Transform() {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                m_matrix[i][j] = (i == j) ? 1.0 : 0.0;
+                m_inverse[i][j] = (i == j) ? 1.0 : 0.0;
+            }
+        }
+    }
+
+    static Transform translation(const vector &t_offset) {
+        Transform transform;
+
+        for (int i = 0; i < 3; i++) {
+            transform.m_matrix[i][3] = t_offset[i];
+            transform.m_inverse[i][3] = -t_offset[i];
+        }
+
+        return transform;
+    }
+
+    static Transform scaling(const vector &t_factors) {
+        Transform transform;
+
+        for (int i = 0; i < 3; i++) {
+            transform.m_matrix[i][i] = t_factors[i];
+            transform.m_inverse[i][i] = 1.0 / t_factors[i];
+        }
+
+        return transform;
+    }
+
+    // Rotation by an angle in degrees around one of the coordinate axes
+    static Transform rotation(int t_axis, double t_degrees) {
+        Transform transform;
+
+        double cos = std::cos(deg2rad(t_degrees));
+        double sin = std::sin(deg2rad(t_degrees));
+
+        int a = (t_axis + 1) % 3;
+        int b = (t_axis + 2) % 3;
+
+        transform.m_matrix[a][a] = cos;
+        transform.m_matrix[a][b] = -sin;
+        transform.m_matrix[b][a] = sin;
+        transform.m_matrix[b][b] = cos;
+
+        // The inverse of a rotation is its transpose
+        transform.m_inverse[a][a] = cos;
+        transform.m_inverse[a][b] = sin;
+        transform.m_inverse[b][a] = -sin;
+        transform.m_inverse[b][b] = cos;
+
+        return transform;
+    }
+
+    // Applies t_other first, then this transform
+    Transform operator*(const Transform &t_other) const {
+        Transform transform;
+
+        multiply(m_matrix, t_other.m_matrix, transform.m_matrix);
+        multiply(t_other.m_inverse, m_inverse, transform.m_inverse);
+
+        return transform;
+    }
+
+    point applyToPoint(const point &t_point) const {
+        return transformPoint(m_matrix, t_point);
+    }
+
+    vector applyToVector(const vector &t_vector) const {
+        return transformVector(m_matrix, t_vector);
+    }
+
+    // Normals go through the inverse transpose, so they stay perpendicular
+    vector applyToNormal(const vector &t_normal) const {
+        return vector(
+            m_inverse[0][0] * t_normal[0] + m_inverse[1][0] * t_normal[1] + m_inverse[2][0] * t_normal[2],
+            m_inverse[0][1] * t_normal[0] + m_inverse[1][1] * t_normal[1] + m_inverse[2][1] * t_normal[2],
+            m_inverse[0][2] * t_normal[0] + m_inverse[1][2] * t_normal[1] + m_inverse[2][2] * t_normal[2]);
+    }
+
+    point inversePoint(const point &t_point) const {
+        return transformPoint(m_inverse, t_point);
+    }
+
+    vector inverseVector(const vector &t_vector) const {
+        return transformVector(m_inverse, t_vector);
+    }
+
+    AABB applyToBox(const AABB &t_box) const {
+        if (!t_box.isFinite()) return AABB::infinite();
+
+        point min = t_box.getMin();
+        point max = t_box.getMax();
+
+        AABB box;
+
+        for (int corner = 0; corner < 8; corner++) {
+            box.expand(applyToPoint(point(
+                (corner & 1) ? max[0] : min[0],
+                (corner & 2) ? max[1] : min[1],
+                (corner & 4) ? max[2] : min[2])));
+        }
+
+        return box;
+    }
+
+    ~Transform() = default;
+};
+
+#endif
@@ -1,8 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
 #include <limits>
-#include <random>
 
 
 const double pi = 3.141592653589;
@@ -17,44 +17,58 @@ inline double rad2deg(double rad) {
     return rad * 180.0 / pi;
 };
 
-inline double random_double() {
-    static std::default_random_engine generator;
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
+// SplitMix64 finalizer: turns neighbouring integers into unrelated ones
+inline uint64_t splitmix64(uint64_t value) {
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
 
-    return distribution(generator);
-};
+    return value ^ (value >> 31);
+}
 
-inline double random_double(double min, double max) {
-    return min + (max - min) * random_double();
+// PCG32 generator (O'Neill, 2014): a 64 bit LCG whose output is permuted
+// down to 32 bits. Each pixel gets its own generator, so the image depends
+// only on the seed and not on how the pixels are shared among threads.
+class RNG {
+private:
+    uint64_t m_state;
+    uint64_t m_increment;
+
+public:
+    // Mixing the stream keeps neighbouring pixels from getting related streams
+    RNG(uint64_t t_seed = 0, uint64_t t_stream = 0) {
+        m_state = 0;
+        m_increment = (splitmix64(t_stream) << 1) | 1;
+
+        nextUInt();
+        m_state += splitmix64(t_seed);
+        nextUInt();
+    }
+
+    uint32_t nextUInt() {
+        uint64_t old_state = m_state;
+        m_state = old_state * 6364136223846793005ull + m_increment;
+
+        uint32_t shifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+        uint32_t rotation = static_cast<uint32_t>(old_state >> 59);
+
+        return (shifted >> rotation) | (shifted << ((0u - rotation) & 31));
+    }
+
+    // Uniform in [0, 1)
+    double nextDouble() {
+        return nextUInt() * (1.0 / 4294967296.0);
+    }
+
+    ~RNG() = default;
 };
 
-inline vector random_vector() {
-    return vector(
-        random_double(),
-        random_double(),
-        random_double()
-    );
+inline double random_double(RNG &rng) {
+    return rng.nextDouble();
 };
 
-inline vector random_vector(double min, double max) {
-    return vector(
-        random_double(min, max),
-        random_double(min, max),
-        random_double(min, max)
-    );
+inline double random_double(RNG &rng, double min, double max) {
+    return min + (max - min) * random_double(rng);
 };
 
-inline vector random_unit_vector() {
-    double phi = random_double(0.0, pi);
-    double theta = random_double(0.0, tau);
-
-    return vector(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
-}
-
-inline vector random_on_hemisphere(const vector &normal) {
-    vector unit_vector = random_unit_vector();
-
-    return (dot(unit_vector, normal) > 0.0) ? unit_vector : -unit_vector;
-}
-
 #endif
@@ -3,144 +3,307 @@
 
 #include <cmath>
 
+#include "cpu.hpp"
 
-inline float quake_sqrt(float number){
-    long i;
 
-    float x = number * 0.5;
-    float y = number;
+// Scalar type of the vectors, rays and hits the renderer works with. Double
+// by default; build with -DRT_FLOAT for single precision.
+#ifdef RT_FLOAT
+    using real = float;
+#else
+    using real = double;
+#endif
+
+
+// Four lanes of T, the registers behind basic_vector. Only the first three
+// lanes mean anything. This version is plain C++ for targets without SSE.
+template <typename T>
+struct VectorLanes {
+    T v[4];
+
+    static VectorLanes load(const T *p) { return {{ p[0], p[1], p[2], p[3] }}; }
+
+    static VectorLanes broadcast(T t) { return {{ t, t, t, t }}; }
+
+    void store(T *p) const {
+        for (int i = 0; i < 4; i++) p[i] = v[i];
+    }
+
+    VectorLanes yzx() const { return {{ v[1], v[2], v[0], v[3] }}; }
+    VectorLanes zxy() const { return {{ v[2], v[0], v[1], v[3] }}; }
+
+    static VectorLanes cross(const VectorLanes &a, const VectorLanes &b) {
+        return a.yzx() * b.zxy() - a.zxy() * b.yzx();
+    }
+
+    // Of the first three lanes, in the order x + y + z
+    T sum3() const { return v[0] + v[1] + v[2]; }
+
+    friend VectorLanes operator+(const VectorLanes &a, const VectorLanes &b) {
+        return {{ a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] }};
+    }
+
+    friend VectorLanes operator-(const VectorLanes &a, const VectorLanes &b) {
+        return {{ a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] }};
+    }
+
+    friend VectorLanes operator*(const VectorLanes &a, const VectorLanes &b) {
+        return {{ a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] }};
+    }
+};
+
+
+#ifdef RT_X86
+
+// One SSE register
+template <>
+struct VectorLanes<float> {
+    __m128 v;
+
+    static VectorLanes load(const float *p) { return { _mm_load_ps(p) }; }
+
+    static VectorLanes broadcast(float t) { return { _mm_set1_ps(t) }; }
+
+    void store(float *p) const { _mm_store_ps(p, v); }
+
+    VectorLanes yzx() const { return { _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)) }; }
+    VectorLanes zxy() const { return { _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2)) }; }
+
+    static VectorLanes cross(const VectorLanes &a, const VectorLanes &b) {
+        return a.yzx() * b.zxy() - a.zxy() * b.yzx();
+    }
+
+    float sum3() const {
+        __m128 y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_movehl_ps(v, v);
+
+        return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(v, y), z));
+    }
+
+    friend VectorLanes operator+(const VectorLanes &a, const VectorLanes &b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend VectorLanes operator-(const VectorLanes &a, const VectorLanes &b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend VectorLanes operator*(const VectorLanes &a, const VectorLanes &b) { return { _mm_mul_ps(a.v, b.v) }; }
+};
+
+
+#ifdef __AVX2__
+
+// One AVX register, when the whole build targets AVX2
+template <>
+struct VectorLanes<double> {
+    __m256d v;
+
+    static VectorLanes load(const double *p) { return { _mm256_load_pd(p) }; }
+
+    static VectorLanes broadcast(double t) { return { _mm256_set1_pd(t) }; }
+
+    void store(double *p) const { _mm256_store_pd(p, v); }
+
+    VectorLanes yzx() const { return { _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 0, 2, 1)) }; }
+    VectorLanes zxy() const { return { _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 1, 0, 2)) }; }
+
+    static VectorLanes cross(const VectorLanes &a, const VectorLanes &b) {
+        return a.yzx() * b.zxy() - a.zxy() * b.yzx();
+    }
+
+    double sum3() const {
+        __m128d xy = _mm256_castpd256_pd128(v);
+        __m128d zw = _mm256_extractf128_pd(v, 1);
+
+        return _mm_cvtsd_f64(_mm_add_sd(_mm_add_sd(xy, _mm_unpackhi_pd(xy, xy)), zw));
+    }
+
+    friend VectorLanes operator+(const VectorLanes &a, const VectorLanes &b) { return { _mm256_add_pd(a.v, b.v) }; }
+    friend VectorLanes operator-(const VectorLanes &a, const VectorLanes &b) { return { _mm256_sub_pd(a.v, b.v) }; }
+    friend VectorLanes operator*(const VectorLanes &a, const VectorLanes &b) { return { _mm256_mul_pd(a.v, b.v) }; }
+};
+
+#else
+
+// Two SSE2 registers, which every x86-64 CPU has
+template <>
+struct VectorLanes<double> {
+    __m128d xy, zw;
+
+    static VectorLanes load(const double *p) { return { _mm_load_pd(p), _mm_load_pd(p + 2) }; }
+
+    static VectorLanes broadcast(double t) { return { _mm_set1_pd(t), _mm_set1_pd(t) }; }
+
+    void store(double *p) const {
+        _mm_store_pd(p, xy);
+        _mm_store_pd(p + 2, zw);
+    }
+
+    VectorLanes yzx() const { return { _mm_shuffle_pd(xy, zw, 1), _mm_shuffle_pd(xy, zw, 2) }; }
+    VectorLanes zxy() const { return { _mm_shuffle_pd(zw, xy, 0), _mm_shuffle_pd(xy, zw, 3) }; }
 
-    const float threehalfs = 1.5f;
+    // Lane by lane: across two registers the shuffles cost more than they save
+    static VectorLanes cross(const VectorLanes &a, const VectorLanes &b) {
+        double ax = _mm_cvtsd_f64(a.xy), ay = _mm_cvtsd_f64(_mm_unpackhi_pd(a.xy, a.xy)), az = _mm_cvtsd_f64(a.zw);
+        double bx = _mm_cvtsd_f64(b.xy), by = _mm_cvtsd_f64(_mm_unpackhi_pd(b.xy, b.xy)), bz = _mm_cvtsd_f64(b.zw);
 
-    i = *(long *) &y;  // evil floating point bit level hacking
-    i = 0x5f3759df - (i >> 1); // what the ****?
-    y = *(float *) &i;
-    y = y * (threehalfs - (x * y * y));  // 1st iteration
-    y = y * (threehalfs - (x * y * y));  // 2nd iteration
+        return { _mm_set_pd(az * bx - ax * bz, ay * bz - az * by), _mm_set_sd(ax * by - ay * bx) };
+    }
+
+    double sum3() const {
+        return _mm_cvtsd_f64(_mm_add_sd(_mm_add_sd(xy, _mm_unpackhi_pd(xy, xy)), zw));
+    }
+
+    friend VectorLanes operator+(const VectorLanes &a, const VectorLanes &b) {
+        return { _mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw) };
+    }
+
+    friend VectorLanes operator-(const VectorLanes &a, const VectorLanes &b) {
+        return { _mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw) };
+    }
+
+    friend VectorLanes operator*(const VectorLanes &a, const VectorLanes &b) {
+        return { _mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw) };
+    }
+};
+
+#endif
+
+#endif
 
-    return y;
+
+// 1 / sqrt(x). In float, the hardware estimate, good to 12 bits, and a
+// Newton step that doubles them. Double would need two steps more, which
+// are slower than a square root and a division, and those are exact.
+inline float inverse_sqrt(float x) {
+#ifdef RT_X86
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+
+    return y * (1.5f - 0.5f * x * y * y);
+#else
+    return 1.0f / std::sqrt(x);
+#endif
 }
 
-class vector {
+inline double inverse_sqrt(double x) {
+    return 1.0 / std::sqrt(x);
+}
+
+
+// Padded to four lanes and aligned to its size, so each operator is one or
+// two SIMD instructions and no vector straddles a cache line. The operators
+// are friends defined in the class, so they are found for every
+// basic_vector<T> and still convert a double argument to T.
+template <typename T>
+class alignas(4 * sizeof(T)) basic_vector {
+private:
+    using Lanes = VectorLanes<T>;
+
+    explicit basic_vector(const Lanes &t_lanes) { t_lanes.store(e); }
+
+    Lanes lanes() const { return Lanes::load(e); }
+
 public:
-    double e[3];
+    using scalar = T;
+
+    T e[4];   // The fourth is padding, which nothing reads
 
-    vector() : e{0.0, 0.0, 0.0} {}
+    basic_vector() : e{0, 0, 0, 0} {}
 
-    vector(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    basic_vector(T e0, T e1, T e2) : e{e0, e1, e2, 0} {}
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    // Between precisions, only when asked for
+    template <typename U>
+    explicit basic_vector(const basic_vector<U> &v) :
+        e{static_cast<T>(v.e[0]), static_cast<T>(v.e[1]), static_cast<T>(v.e[2]), 0} {}
 
-    double operator[](int i) const { return e[i]; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    double &operator[](int i) { return e[i]; }
+    T operator[](int i) const { return e[i]; }
 
-    vector operator-() const { return vector(-e[0], -e[1], -e[2]); }
+    T &operator[](int i) { return e[i]; }
 
-    vector &operator+=(const vector &v) {
-        e[0] += v.e[0];
-        e[1] += v.e[1];
-        e[2] += v.e[2];
+    basic_vector operator-() const { return basic_vector(Lanes::broadcast(-1) * lanes()); }
 
+    basic_vector &operator+=(const basic_vector &v) {
+        (lanes() + v.lanes()).store(e);
         return *this;
     }
 
-    vector &operator-=(const vector &v) {
-        return *this += -v;
+    basic_vector &operator-=(const basic_vector &v) {
+        (lanes() - v.lanes()).store(e);
+        return *this;
     }
 
-    vector &operator*=(double t) {
-        e[0] *= t;
-        e[1] *= t;
-        e[2] *= t;
-
+    basic_vector &operator*=(T t) {
+        (Lanes::broadcast(t) * lanes()).store(e);
         return *this;
     }
 
-    vector &operator/=(double t) {
-        return *this *= 1.0 / t;
+    basic_vector &operator/=(T t) {
+        return *this *= 1 / t;
     }
 
-    double squared_norm() const {
-        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+    T squared_norm() const {
+        return (lanes() * lanes()).sum3();
     }
 
-    double norm() const {
+    T norm() const {
         return std::sqrt(squared_norm());
     }
 
     bool near_zero() const {
-        double threshold = 1e-8;
+        T threshold = static_cast<T>(1e-8);
 
-        return e[0] <= threshold && e[1] <= threshold && e[2] <= threshold;
+        return std::fabs(e[0]) <= threshold && std::fabs(e[1]) <= threshold && std::fabs(e[2]) <= threshold;
     }
 
-    ~vector() = default;
-};
-
+    friend std::ostream &operator<<(std::ostream &out, const basic_vector &v) {
+        return out << v.x() << " " << v.y() << " " << v.z();
+    }
 
-using point = vector;
+    friend basic_vector operator+(const basic_vector &u, const basic_vector &v) {
+        return basic_vector(u.lanes() + v.lanes());
+    }
 
+    friend basic_vector operator-(const basic_vector &u, const basic_vector &v) {
+        return basic_vector(u.lanes() - v.lanes());
+    }
 
-inline std::ostream &operator<<(std::ostream &out, const vector &v) {
-    return out << v.x() << " " << v.y() << " " << v.z();
-}
+    friend basic_vector operator*(const basic_vector &u, const basic_vector &v) {
+        return basic_vector(u.lanes() * v.lanes());
+    }
 
-inline vector operator+(const vector &u, const vector &v) {
-    return vector(
-        u.e[0] + v.e[0],
-        u.e[1] + v.e[1],
-        u.e[2] + v.e[2]);
-}
+    friend basic_vector operator*(T t, const basic_vector &v) {
+        return basic_vector(Lanes::broadcast(t) * v.lanes());
+    }
 
-inline vector operator-(const vector &u, const vector &v) {
-    return vector(
-        u.e[0] - v.e[0],
-        u.e[1] - v.e[1],
-        u.e[2] - v.e[2]);
-}
+    friend basic_vector operator*(const basic_vector &v, T t) {
+        return t * v;
+    }
 
-inline vector operator*(const vector &u, const vector &v) {
-    return vector(
-        u.e[0] * v.e[0],
-        u.e[1] * v.e[1],
-        u.e[2] * v.e[2]);
-}
+    friend basic_vector operator/(const basic_vector &v, T t) {
+        return (1 / t) * v;
+    }
 
-inline vector operator*(double t, const vector &v) {
-    return vector(t * v.e[0], t * v.e[1], t * v.e[2]);
-}
+    friend T dot(const basic_vector &u, const basic_vector &v) {
+        return (u.lanes() * v.lanes()).sum3();
+    }
 
-inline vector operator*(const vector &v, double t) {
-    return t * v;
-}
+    friend basic_vector cross(const basic_vector &u, const basic_vector &v) {
+        return basic_vector(Lanes::cross(u.lanes(), v.lanes()));
+    }
 
-inline vector operator/(const vector &v, double t) {
-    return (1.0 / t) * v;
-}
+    friend basic_vector normalize(const basic_vector &v) {
+        return v * inverse_sqrt(v.squared_norm());
+    }
 
-inline double dot(const vector &u, const vector &v) {
-    return (
-        u.e[0] * v.e[0] +
-        u.e[1] * v.e[1] +
-        u.e[2] * v.e[2]);
-}
+    friend basic_vector lerp(const basic_vector &u, const basic_vector &v, T t) {
+        return basic_vector(Lanes::broadcast(1 - t) * u.lanes() + Lanes::broadcast(t) * v.lanes());
+    }
 
-inline vector cross(const vector &u, const vector &v) {
-    return vector(
-        u.e[1] * v.e[2] - u.e[2] * v.e[1],
-        u.e[2] * v.e[0] - u.e[0] * v.e[2],
-        u.e[0] * v.e[1] - u.e[1] * v.e[0]);
-}
+    ~basic_vector() = default;
+};
 
-inline vector normalize(const vector &v) {
-    return v * quake_sqrt(v.squared_norm());
-}
 
-inline vector lerp(const vector &u, const vector &v, double t) {
-    return (1.0 - t) * u + t * v;
-}
+using vector = basic_vector<real>;
+using point = vector;
 
 #endif
@@ -0,0 +1,448 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "bvh_tree.hpp"
+#include "cpu.hpp"
+
+
+// Child bounds are stored as structure of arrays, one lane per child, so a
+// single instruction tests the ray against every child on one slab plane
+template <int W>
+struct alignas(32) WideBVHNode {
+    float bounds[6][W];   // Rows: min x, y, z then max x, y, z
+    int child[W];         // Interior: wide node index, leaf: first primitive
+    int count[W];         // Primitives in a leaf child, zero otherwise
+};
+
+
+// Single precision copy of InverseRay, laid out for broadcasting into lanes
+struct WideRay {
+    float inv_direction[3];
+    float scaled_origin[3];
+
+    int near_row[3];   // Bounds row holding the near slab plane of each axis
+    int far_row[3];
+
+    WideRay(const InverseRay &t_inverse) {
+        for (int axis = 0; axis < 3; axis++) {
+            inv_direction[axis] = static_cast<float>(t_inverse.inv_direction[axis]);
+            scaled_origin[axis] = static_cast<float>(t_inverse.scaled_origin[axis]);
+
+            near_row[axis] = t_inverse.negative[axis] ? axis + 3 : axis;
+            far_row[axis] = t_inverse.negative[axis] ? axis : axis + 3;
+        }
+    }
+};
+
+
+// Entry of the traversal stack; a positive count marks a leaf
+struct WideStackEntry {
+    int index;
+    int count;
+    float t_near;
+};
+
+
+// Scales the far distance up by a few ulps so the float test stays conservative
+const float wide_far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+// Deepest interior node the traversal stack has room for; the builders stay
+// well below it, and loaded trees are checked against it
+const int wide_max_depth = 64;
+
+
+template <int W>
+inline int test_children_scalar(const WideBVHNode<W> &node, const WideRay &ray, float t_max, float *t_near) {
+    int mask = 0;
+
+    for (int lane = 0; lane < W; lane++) {
+        float enter = 0.001f;
+        float exit = t_max;
+
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = node.bounds[ray.near_row[axis]][lane] * ray.inv_direction[axis] - ray.scaled_origin[axis];
+            float t1 = node.bounds[ray.far_row[axis]][lane] * ray.inv_direction[axis] - ray.scaled_origin[axis];
+
+            enter = (t0 > enter) ? t0 : enter;
+            exit = (t1 < exit) ? t1 : exit;
+        }
+
+        t_near[lane] = enter;
+        if (enter <= exit * wide_far_scale) mask |= 1 << lane;
+    }
+
+    return mask;
+}
+
+
+#ifdef RT_X86
+
+inline int test_children_sse(const WideBVHNode<4> &node, const WideRay &ray, float t_max, float *t_near) {
+    __m128 enter = _mm_set1_ps(0.001f);
+    __m128 exit = _mm_set1_ps(t_max);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 inv = _mm_set1_ps(ray.inv_direction[axis]);
+        __m128 origin = _mm_set1_ps(ray.scaled_origin[axis]);
+
+        __m128 t0 = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(node.bounds[ray.near_row[axis]]), inv), origin);
+        __m128 t1 = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(node.bounds[ray.far_row[axis]]), inv), origin);
+
+        enter = _mm_max_ps(enter, t0);
+        exit = _mm_min_ps(exit, t1);
+    }
+
+    _mm_storeu_ps(t_near, enter);
+
+    exit = _mm_mul_ps(exit, _mm_set1_ps(wide_far_scale));
+    return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+}
+
+TARGET_AVX2
+inline int test_children_avx2(const WideBVHNode<8> &node, const WideRay &ray, float t_max, float *t_near) {
+    __m256 enter = _mm256_set1_ps(0.001f);
+    __m256 exit = _mm256_set1_ps(t_max);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m256 inv = _mm256_set1_ps(ray.inv_direction[axis]);
+        __m256 origin = _mm256_set1_ps(ray.scaled_origin[axis]);
+
+        __m256 t0 = _mm256_fmsub_ps(_mm256_load_ps(node.bounds[ray.near_row[axis]]), inv, origin);
+        __m256 t1 = _mm256_fmsub_ps(_mm256_load_ps(node.bounds[ray.far_row[axis]]), inv, origin);
+
+        enter = _mm256_max_ps(enter, t0);
+        exit = _mm256_min_ps(exit, t1);
+    }
+
+    _mm256_storeu_ps(t_near, enter);
+
+    exit = _mm256_mul_ps(exit, _mm256_set1_ps(wide_far_scale));
+    return _mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+}
+
+#endif
+
+
+class WideBVHTree {
+private:
+    std::vector<WideBVHNode<4>> m_nodes4;
+    std::vector<WideBVHNode<8>> m_nodes8;
+
+    // Nodes owned by someone else, such as a mapped mesh file
+    const void * m_view = nullptr;
+    int m_view_count = 0;
+
+    int m_width = 0;
+
+    const WideBVHNode<4> * nodes4() const {
+        return m_view ? static_cast<const WideBVHNode<4> *>(m_view) : m_nodes4.data();
+    }
+
+    const WideBVHNode<8> * nodes8() const {
+        return m_view ? static_cast<const WideBVHNode<8> *>(m_view) : m_nodes8.data();
+    }
+
+    // Rounds outwards, so the float box always contains the double one
+    static float roundDown(double value) {
+        float f = static_cast<float>(value);
+        return (f > value) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float roundUp(double value) {
+        float f = static_cast<float>(value);
+        return (f < value) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // Primitives below each binary node; a subtree covers a contiguous range
+    // starting at the first primitive of its left child
+    struct SubtreeRange {
+        int first;
+        int count;
+    };
+
+    static std::vector<SubtreeRange> subtreeRanges(const std::vector<BVHNode> &binary) {
+        std::vector<SubtreeRange> ranges(binary.size());
+
+        // Children always come after their parent, so one backward pass suffices
+        for (int i = static_cast<int>(binary.size()) - 1; i >= 0; i--) {
+            const BVHNode &node = binary[i];
+
+            if (node.count > 0) {
+                ranges[i] = SubtreeRange{ node.offset, node.count };
+
+            } else {
+                ranges[i] = SubtreeRange{
+                    ranges[node.offset].first,
+                    ranges[node.offset].count + ranges[node.offset + 1].count };
+            }
+        }
+
+        return ranges;
+    }
+
+    // Pulls grandchildren up into a node by repeatedly opening the interior
+    // child with the largest surface area, until W children are collected
+    template <int W>
+    int collapse(
+        const std::vector<BVHNode> &binary, const std::vector<SubtreeRange> &ranges,
+        int leaf_size, int binary_index, std::vector<WideBVHNode<W>> &nodes) {
+
+        int wide_index = static_cast<int>(nodes.size());
+        nodes.push_back(WideBVHNode<W>());
+
+        auto is_leaf = [&](int index) {
+            return binary[index].count > 0 || ranges[index].count <= leaf_size;
+        };
+
+        int children[W];
+        int child_count = 0;
+
+        const BVHNode &root = binary[binary_index];
+
+        if (is_leaf(binary_index)) {
+            children[child_count++] = binary_index;
+
+        } else {
+            children[child_count++] = root.offset;
+            children[child_count++] = root.offset + 1;
+        }
+
+        while (child_count < W) {
+            int best = -1;
+            double best_area = -1.0;
+
+            for (int i = 0; i < child_count; i++) {
+                const BVHNode &node = binary[children[i]];
+
+                if (!is_leaf(children[i]) && node.bounds.surfaceArea() > best_area) {
+                    best = i;
+                    best_area = node.bounds.surfaceArea();
+                }
+            }
+
+            if (best == -1) break;
+
+            int opened = children[best];
+            children[best] = binary[opened].offset;
+            children[child_count++] = binary[opened].offset + 1;
+        }
+
+        float inf = std::numeric_limits<float>::infinity();
+
+        for (int lane = 0; lane < W; lane++) {
+            if (lane >= child_count) {
+                // Inverted bounds, which no ray can enter
+                for (int axis = 0; axis < 3; axis++) {
+                    nodes[wide_index].bounds[axis][lane] = inf;
+                    nodes[wide_index].bounds[axis + 3][lane] = -inf;
+                }
+
+                nodes[wide_index].child[lane] = -1;
+                nodes[wide_index].count[lane] = 0;
+
+                continue;
+            }
+
+            const BVHNode &node = binary[children[lane]];
+            point min = node.bounds.getMin();
+            point max = node.bounds.getMax();
+
+            for (int axis = 0; axis < 3; axis++) {
+                nodes[wide_index].bounds[axis][lane] = roundDown(min[axis]);
+                nodes[wide_index].bounds[axis + 3][lane] = roundUp(max[axis]);
+            }
+
+            bool leaf = is_leaf(children[lane]);
+
+            nodes[wide_index].count[lane] = leaf ? ranges[children[lane]].count : 0;
+            nodes[wide_index].child[lane] = leaf ? ranges[children[lane]].first : -1;
+        }
+
+        // Recursing last keeps the references above valid while nodes grows
+        for (int lane = 0; lane < child_count; lane++) {
+            if (!is_leaf(children[lane])) {
+                int child = collapse(binary, ranges, leaf_size, children[lane], nodes);
+                nodes[wide_index].child[lane] = child;
+            }
+        }
+
+        return wide_index;
+    }
+
+    // Shared by every width; Test returns the mask of children the ray enters.
+    // With AnyHit the first primitive hit ends the traversal.
+    template <int W, bool AnyHit, typename Test, typename F>
+    static inline bool traverseNodes(
+        const WideBVHNode<W> * nodes, int node_count, const Ray &ray, double t_max,
+        Test &&test, F &&intersect) {
+
+        if (node_count == 0) return false;
+
+        InverseRay inverse = InverseRay(ray);
+        WideRay wide_ray = WideRay(inverse);
+
+        WideStackEntry stack[wide_max_depth * W];
+        int top = 0;
+
+        stack[top++] = WideStackEntry{ 0, 0, 0.0f };
+
+        bool hit = false;
+
+        while (top > 0) {
+            WideStackEntry entry = stack[--top];
+
+            if (entry.t_near > t_max) continue;
+
+            if (entry.count > 0) {
+                for (int i = 0; i < entry.count; i++) {
+                    if (intersect(entry.index + i, t_max)) {
+                        if (AnyHit) return true;
+                        hit = true;
+                    }
+                }
+
+                continue;
+            }
+
+            const WideBVHNode<W> &node = nodes[entry.index];
+
+            alignas(32) float t_near[W];
+            int mask = test(node, wide_ray, static_cast<float>(t_max), t_near);
+
+            // Pushes the hit children farthest first, so the nearest is popped next
+            int first = top;
+
+            while (mask) {
+                int lane = lowest_set_bit(mask);
+                mask &= mask - 1;
+
+                WideStackEntry child = WideStackEntry{ node.child[lane], node.count[lane], t_near[lane] };
+
+                int position = top++;
+                while (position > first && stack[position - 1].t_near < child.t_near) {
+                    stack[position] = stack[position - 1];
+                    position--;
+                }
+
+                stack[position] = child;
+            }
+        }
+
+        return hit;
+    }
+
+    // Only reached for 8 wide nodes loaded on a machine without AVX2
+    template <bool AnyHit, typename F>
+    bool traverse8Scalar(const Ray &ray, double t_max, F &intersect) const {
+        return traverseNodes<8, AnyHit>(nodes8(), getNodeCount(), ray, t_max, test_children_scalar<8>, intersect);
+    }
+
+#ifdef RT_X86
+    template <bool AnyHit, typename F>
+    bool traverse4(const Ray &ray, double t_max, F &intersect) const {
+        return traverseNodes<4, AnyHit>(nodes4(), getNodeCount(), ray, t_max, test_children_sse, intersect);
+    }
+
+    template <bool AnyHit, typename F>
+    TARGET_AVX2 FLATTEN
+    bool traverse8(const Ray &ray, double t_max, F &intersect) const {
+        return traverseNodes<8, AnyHit>(nodes8(), getNodeCount(), ray, t_max, test_children_avx2, intersect);
+    }
+#else
+    template <bool AnyHit, typename F>
+    bool traverse4(const Ray &ray, double t_max, F &intersect) const {
+        return traverseNodes<4, AnyHit>(nodes4(), getNodeCount(), ray, t_max, test_children_scalar<4>, intersect);
+    }
+
+    template <bool AnyHit, typename F>
+    bool traverse8(const Ray &ray, double t_max, F &intersect) const {
+        return traverse8Scalar<AnyHit>(ray, t_max, intersect);
+    }
+#endif
+
+    template <bool AnyHit, typename F>
+    bool dispatch(const Ray &ray, double t_max, F &intersect) const {
+        if (m_width == 4) return traverse4<AnyHit>(ray, t_max, intersect);
+        if (cpu_supports_avx2()) return traverse8<AnyHit>(ray, t_max, intersect);
+
+        return traverse8Scalar<AnyHit>(ray, t_max, intersect);
+    }
+
+public:
+    WideBVHTree() {}
+
+    // Widest supported layout: 8 with AVX2, 4 with SSE and elsewhere
+    static int nativeWidth() {
+        return cpu_supports_avx2() ? 8 : 4;
+    }
+
+    // Collapses a binary tree into 4 or 8 wide nodes (0 picks nativeWidth).
+    // The layout does not depend on the CPU: 8 wide nodes are built as asked
+    // without AVX2 too, and traversed with the scalar test.
+    // Subtrees with at most t_leaf_size primitives become a single leaf lane:
+    // the binary builders split almost down to single primitives, which
+    // leaves most lanes empty when primitives are as cheap as triangles.
+    void build(const BVHTree &t_tree, int t_width = 0, int t_leaf_size = 0) {
+        m_width = (t_width == 0) ? nativeWidth() : t_width;
+
+        m_nodes4.clear();
+        m_nodes8.clear();
+
+        m_view = nullptr;
+        m_view_count = 0;
+
+        if (t_tree.getNodeCount() == 0) return;
+
+        std::vector<SubtreeRange> ranges = subtreeRanges(t_tree.getNodes());
+
+        if (m_width == 8) collapse<8>(t_tree.getNodes(), ranges, t_leaf_size, 0, m_nodes8);
+        else collapse<4>(t_tree.getNodes(), ranges, t_leaf_size, 0, m_nodes4);
+    }
+
+    // Uses nodes stored elsewhere in place; they must outlive the tree.
+    // The memory must hold t_count nodes of width t_width, 32 byte aligned.
+    void view(int t_width, const void * t_nodes, int t_count) {
+        m_nodes4.clear();
+        m_nodes8.clear();
+
+        m_width = t_width;
+        m_view = t_nodes;
+        m_view_count = t_count;
+    }
+
+    int getWidth() const { return m_width; }
+
+    int getNodeCount() const {
+        if (m_view) return m_view_count;
+        return static_cast<int>((m_width == 8) ? m_nodes8.size() : m_nodes4.size());
+    }
+
+    // Raw node memory, as written to mesh files
+    const void * getNodeData() const {
+        return (m_width == 8) ? static_cast<const void *>(nodes8()) : static_cast<const void *>(nodes4());
+    }
+
+    size_t getNodeSize() const {
+        return (m_width == 8) ? sizeof(WideBVHNode<8>) : sizeof(WideBVHNode<4>);
+    }
+
+    // Same contract as BVHTree::traverse, with positions in the same leaf order
+    template <typename F>
+    bool traverse(const Ray &ray, double t_max, F &&intersect) const {
+        return dispatch<false>(ray, t_max, intersect);
+    }
+
+    // Same contract as BVHTree::occluded
+    template <typename F>
+    bool occluded(const Ray &ray, double t_max, F &&intersect) const {
+        return dispatch<true>(ray, t_max, intersect);
+    }
+
+    ~WideBVHTree() = default;
+};
+
+#endif
@@ -1,19 +1,108 @@
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+
 #include "headers/handler.hpp"
 #include "headers/camera.hpp"
 
 #include "source/world.cpp"
 
 
-int main() {
+// Farm jobs get SIGTERM before they are killed; the render stops and saves
+void stop_render(int) {
+    render_stop_requested = true;
+}
+
+
+// Options: --checkpoint <file> saves the render every minute and resumes
+// from the file if it exists; --time <seconds> renders to a time budget;
+// --builder linear|binned|sweep picks how the BVH is built, linear being the
+// fastest to rebuild while looking at a scene
+int main(int argc, char ** argv) {
     int width = 800;
     int height = 450;
 
-    HittableList world = construct_world("scene_2.xml");
+    std::string checkpoint;
+    double time_budget = 0.0;
+    BVHBuilder builder = BVHBuilder::Binned;
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+
+        if (i + 1 < argc && option == "--checkpoint") {
+            checkpoint = argv[i + 1];
+
+        } else if (i + 1 < argc && option == "--time") {
+            time_budget = std::atof(argv[i + 1]);
+
+        } else if (i + 1 < argc && option == "--builder") {
+            std::string name = argv[i + 1];
+
+            if (name == "linear") {
+                builder = BVHBuilder::Linear;
+
+            } else if (name == "binned") {
+                builder = BVHBuilder::Binned;
+
+            } else if (name == "sweep") {
+                builder = BVHBuilder::Sweep;
+
+            } else {
+                std::cerr << "ERROR: Unknown BVH builder '" << name << "'.\n";
+                return 1;
+            }
+
+        } else {
+            std::cerr << "ERROR: Unknown option '" << option << "'.\n";
+            return 1;
+        }
+    }
+
+    // Holds every texture, material and object of the scene
+    Arena arena;
+
+    HittableList lights;
+    BVH world = BVH(construct_world("scene_2.xml", arena, lights), builder);
+
+    std::clog << "BVH: " << world.getNodeCount() << " nodes built in "
+              << 1000.0 * world.getBuildTime() << " ms\n";
 
     ImageHandler handler = ImageHandler(width, height, "image.png");
 
     Camera camera = Camera(width, height);
+    camera.setLights(lights);
+
+    // The image so far, every 10 seconds
+    camera.setPreview("preview.png", 10.0);
+    camera.setTimeBudget(time_budget);
+
+    if (!checkpoint.empty()) {
+        camera.setCheckpoint(checkpoint, 60.0);
+
+        if (std::ifstream(checkpoint) && !camera.resume(checkpoint))
+            return 1;
+    }
+
+    std::signal(SIGINT, stop_render);
+    std::signal(SIGTERM, stop_render);
+
     camera.render(handler, world);
 
+    std::clog << "Rendered in " << camera.getRenderTime() << " s, "
+              << camera.getAverageSamples() << " samples per pixel\n";
+    std::clog << "Average path length: " << camera.getAveragePathLength() << " rays\n";
+
+    const std::vector<double> &busy = camera.getBusyTimes();
+    const std::vector<double> &idle = camera.getIdleTimes();
+
+    for (int thread = 0; thread < static_cast<int>(busy.size()); thread++)
+        std::clog << "Thread " << thread << ": " << busy[thread] << " s busy, " << idle[thread] << " s idle\n";
+
+    std::clog << "Tiles stolen: " << camera.getStealCount() << "\n";
+
+    // Brighter pixels took more samples
+    ImageHandler sample_map = ImageHandler(width, height, "samples.png");
+    camera.writeSampleMap(sample_map);
+
     return 0;
 }
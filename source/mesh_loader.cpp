@@ -0,0 +1,760 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../headers/arena.hpp"
+#include "../headers/mesh.hpp"
+
+
+// Flat vertex and index buffers, as read from disk, before any BVH is built
+struct MeshData {
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<uint32_t> indices;
+};
+
+
+// A face corner of an OBJ file, with -1 for a missing uv or normal
+struct ObjCorner {
+    int v, vt, vn;
+
+    bool operator==(const ObjCorner &other) const {
+        return v == other.v && vt == other.vt && vn == other.vn;
+    }
+};
+
+
+struct ObjCornerHash {
+    size_t operator()(const ObjCorner &corner) const {
+        uint64_t key = static_cast<uint32_t>(corner.v);
+        key = key * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(corner.vt);
+        key = key * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(corner.vn);
+
+        return static_cast<size_t>(key ^ (key >> 32));
+    }
+};
+
+
+// OBJ indices are 1-based, and negative ones count back from the end
+inline int obj_index(int index, int count) {
+    return (index > 0) ? index - 1 : count + index;
+}
+
+
+// Parses a face corner written as v, v/vt, v//vn or v/vt/vn, and returns
+// the position just past it
+inline const char * obj_corner(const char * token, int &v, int &vt, int &vn) {
+    char * end;
+
+    v = static_cast<int>(std::strtol(token, &end, 10));
+    vt = vn = 0;
+
+    // Garbage that is not a number is skipped, and caught as index 0 later
+    if (end == token) {
+        while (*end && *end != ' ' && *end != '\t') end++;
+        return end;
+    }
+
+    if (*end != '/') return end;
+    token = end + 1;
+
+    if (*token != '/') {
+        vt = static_cast<int>(std::strtol(token, &end, 10));
+        token = end;
+    }
+
+    if (*token == '/') {
+        vn = static_cast<int>(std::strtol(token + 1, &end, 10));
+        token = end;
+    }
+
+    return token;
+}
+
+
+bool load_obj(const std::string &filename, MeshData &mesh) {
+    std::ifstream file(filename);
+
+    if (!file) {
+        std::cerr << "ERROR: Could not open '" << filename << "'.\n";
+        return false;
+    }
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+
+    // Each distinct v/vt/vn triple becomes one mesh vertex
+    std::unordered_map<ObjCorner, uint32_t, ObjCornerHash> vertices;
+    std::vector<int> corners;
+
+    bool has_uvs = false;
+    bool has_normals = false;
+
+    mesh = MeshData();
+
+    std::string line;
+    while (std::getline(file, line)) {
+        const char * cursor = line.c_str();
+        while (*cursor == ' ' || *cursor == '\t') cursor++;
+
+        char * end;
+
+        // strtof skips the blanks in front of each number on its own
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            cursor += 1;
+
+            for (int axis = 0; axis < 3; axis++) {
+                positions.push_back(std::strtof(cursor, &end));
+                cursor = end;
+            }
+
+        } else if (cursor[0] == 'v' && cursor[1] == 't') {
+            cursor += 2;
+
+            for (int axis = 0; axis < 2; axis++) {
+                uvs.push_back(std::strtof(cursor, &end));
+                cursor = end;
+            }
+
+        } else if (cursor[0] == 'v' && cursor[1] == 'n') {
+            cursor += 2;
+
+            for (int axis = 0; axis < 3; axis++) {
+                normals.push_back(std::strtof(cursor, &end));
+                cursor = end;
+            }
+
+        } else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            int position_count = static_cast<int>(positions.size() / 3);
+            int uv_count = static_cast<int>(uvs.size() / 2);
+            int normal_count = static_cast<int>(normals.size() / 3);
+
+            corners.clear();
+            cursor++;
+
+            while (true) {
+                while (*cursor == ' ' || *cursor == '\t') cursor++;
+                if (*cursor == '\0' || *cursor == '\r' || *cursor == '#') break;
+
+                int v, vt, vn;
+                cursor = obj_corner(cursor, v, vt, vn);
+
+                bool has_vt = (vt != 0);
+                bool has_vn = (vn != 0);
+
+                v = obj_index(v, position_count);
+                vt = has_vt ? obj_index(vt, uv_count) : -1;
+                vn = has_vn ? obj_index(vn, normal_count) : -1;
+
+                // Relative indices may point before the first entry too
+                bool valid =
+                    v >= 0 && v < position_count &&
+                    (!has_vt || (vt >= 0 && vt < uv_count)) &&
+                    (!has_vn || (vn >= 0 && vn < normal_count));
+
+                if (!valid) {
+                    std::cerr << "ERROR: Invalid face index in '" << filename << "'.\n";
+                    return false;
+                }
+
+                has_uvs |= (vt >= 0);
+                has_normals |= (vn >= 0);
+
+                ObjCorner key = ObjCorner{ v, vt, vn };
+                auto found = vertices.find(key);
+
+                if (found == vertices.end()) {
+                    uint32_t index = static_cast<uint32_t>(mesh.positions.size() / 3);
+                    vertices.emplace(key, index);
+
+                    mesh.positions.insert(mesh.positions.end(), &positions[3 * v], &positions[3 * v] + 3);
+
+                    if (vt >= 0) mesh.uvs.insert(mesh.uvs.end(), &uvs[2 * vt], &uvs[2 * vt] + 2);
+                    else mesh.uvs.insert(mesh.uvs.end(), { 0.0f, 0.0f });
+
+                    if (vn >= 0) mesh.normals.insert(mesh.normals.end(), &normals[3 * vn], &normals[3 * vn] + 3);
+                    else mesh.normals.insert(mesh.normals.end(), { 0.0f, 0.0f, 0.0f });
+
+                    corners.push_back(index);
+
+                } else {
+                    corners.push_back(found->second);
+                }
+            }
+
+            // Polygons are split into a fan around their first corner
+            for (size_t i = 2; i < corners.size(); i++) {
+                mesh.indices.push_back(corners[0]);
+                mesh.indices.push_back(corners[i - 1]);
+                mesh.indices.push_back(corners[i]);
+            }
+        }
+    }
+
+    // An empty mesh would have no bounds, and be tested against every ray
+    if (mesh.indices.empty()) {
+        std::cerr << "ERROR: '" << filename << "' has no triangles.\n";
+        return false;
+    }
+
+    // Attributes that no face referenced are dropped altogether
+    if (!has_uvs) mesh.uvs.clear();
+    if (!has_normals) mesh.normals.clear();
+
+    return true;
+}
+
+
+enum class PlyFormat { Ascii, BinaryLittleEndian, BinaryBigEndian };
+
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Unknown };
+
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    PlyType count_type;   // Unknown unless the property is a list
+    bool is_list;
+};
+
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+
+inline PlyType ply_type(const std::string &name) {
+    if (name == "char" || name == "int8") return PlyType::Int8;
+    if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+    if (name == "short" || name == "int16") return PlyType::Int16;
+    if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+    if (name == "int" || name == "int32") return PlyType::Int32;
+    if (name == "uint" || name == "uint32") return PlyType::UInt32;
+    if (name == "float" || name == "float32") return PlyType::Float32;
+    if (name == "double" || name == "float64") return PlyType::Float64;
+
+    return PlyType::Unknown;
+}
+
+
+inline int ply_type_size(PlyType type) {
+    switch (type) {
+        case PlyType::Int8: case PlyType::UInt8: return 1;
+        case PlyType::Int16: case PlyType::UInt16: return 2;
+        case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+        default: return 0;
+    }
+}
+
+
+// Decodes one binary value at the cursor and moves past it
+inline double ply_read(const char * &cursor, PlyType type, bool swap) {
+    unsigned char bytes[8];
+    int size = ply_type_size(type);
+
+    std::memcpy(bytes, cursor, size);
+    if (swap) std::reverse(bytes, bytes + size);
+
+    cursor += size;
+
+    switch (type) {
+        case PlyType::Int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+        case PlyType::UInt8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+        case PlyType::Int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+        case PlyType::UInt16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+        case PlyType::Int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+        case PlyType::UInt32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+        case PlyType::Float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+        default: { double v; std::memcpy(&v, bytes, 8); return v; }
+    }
+}
+
+
+bool load_ply(const std::string &filename, MeshData &mesh) {
+    std::ifstream file(filename, std::ios::binary);
+
+    if (!file) {
+        std::cerr << "ERROR: Could not open '" << filename << "'.\n";
+        return false;
+    }
+
+    std::string line;
+    std::getline(file, line);
+
+    if (line.compare(0, 3, "ply") != 0) {
+        std::cerr << "ERROR: '" << filename << "' is not a PLY file.\n";
+        return false;
+    }
+
+    PlyFormat format = PlyFormat::Ascii;
+    std::vector<PlyElement> elements;
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        std::istringstream stream(line);
+        std::string tag;
+        stream >> tag;
+
+        if (tag == "format") {
+            std::string name;
+            stream >> name;
+
+            if (name == "binary_little_endian") format = PlyFormat::BinaryLittleEndian;
+            else if (name == "binary_big_endian") format = PlyFormat::BinaryBigEndian;
+            else format = PlyFormat::Ascii;
+
+        } else if (tag == "element") {
+            PlyElement element;
+            stream >> element.name >> element.count;
+            elements.push_back(element);
+
+        } else if (tag == "property" && !elements.empty()) {
+            std::string type, count_type;
+            stream >> type;
+
+            PlyProperty property;
+            property.is_list = (type == "list");
+            property.count_type = PlyType::Unknown;
+
+            if (property.is_list) {
+                stream >> count_type >> type;
+                property.count_type = ply_type(count_type);
+            }
+
+            property.type = ply_type(type);
+            stream >> property.name;
+
+            if (property.type == PlyType::Unknown || (property.is_list && property.count_type == PlyType::Unknown)) {
+                std::cerr << "ERROR: Unknown PLY type '" << type << "' in '" << filename << "'.\n";
+                return false;
+            }
+
+            elements.back().properties.push_back(property);
+
+        } else if (tag == "end_header") {
+            break;
+        }
+    }
+
+    if (format == PlyFormat::Ascii) {
+        std::cerr << "ERROR: Only binary PLY files are supported ('" << filename << "').\n";
+        return false;
+    }
+
+    // The body is decoded from memory, which is far quicker than many tiny reads
+    std::vector<char> body(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    const char * cursor = body.data();
+    const char * body_end = body.data() + body.size();
+
+    uint16_t probe = 1;
+    bool little_endian_host = *reinterpret_cast<unsigned char *>(&probe) == 1;
+    bool swap = (format == PlyFormat::BinaryLittleEndian) != little_endian_host;
+
+    mesh = MeshData();
+
+    for (const PlyElement &element: elements) {
+        // Slot of every property in the vertex attributes, or -1 if unused
+        std::vector<int> slots;
+        size_t record_size = 0;
+
+        bool has_normals = false;
+        bool has_uvs = false;
+
+        for (const PlyProperty &property: element.properties) {
+            const std::string &name = property.name;
+            int slot = -1;
+
+            if (name == "x") slot = 0;
+            else if (name == "y") slot = 1;
+            else if (name == "z") slot = 2;
+            else if (name == "nx") slot = 3;
+            else if (name == "ny") slot = 4;
+            else if (name == "nz") slot = 5;
+            else if (name == "u" || name == "s" || name == "texture_u") slot = 6;
+            else if (name == "v" || name == "t" || name == "texture_v") slot = 7;
+
+            has_normals |= (slot >= 3 && slot <= 5);
+            has_uvs |= (slot >= 6);
+
+            slots.push_back(slot);
+            record_size += ply_type_size(property.is_list ? property.count_type : property.type);
+        }
+
+        bool is_vertex = (element.name == "vertex");
+
+        if (is_vertex) {
+            mesh.positions.reserve(3 * element.count);
+            if (has_normals) mesh.normals.reserve(3 * element.count);
+            if (has_uvs) mesh.uvs.reserve(2 * element.count);
+        }
+
+        for (size_t i = 0; i < element.count; i++) {
+            // Lists only grow a record, so this bounds check is a lower bound
+            if (static_cast<size_t>(body_end - cursor) < record_size) {
+                std::cerr << "ERROR: '" << filename << "' is truncated.\n";
+                return false;
+            }
+
+            float values[8] = { 0.0f };
+
+            for (size_t p = 0; p < element.properties.size(); p++) {
+                const PlyProperty &property = element.properties[p];
+
+                if (!property.is_list) {
+                    double value = ply_read(cursor, property.type, swap);
+                    if (slots[p] >= 0) values[slots[p]] = static_cast<float>(value);
+
+                    continue;
+                }
+
+                int count = static_cast<int>(ply_read(cursor, property.count_type, swap));
+
+                if (static_cast<size_t>(body_end - cursor) < static_cast<size_t>(count) * ply_type_size(property.type)) {
+                    std::cerr << "ERROR: '" << filename << "' is truncated.\n";
+                    return false;
+                }
+
+                bool is_face = element.name == "face" &&
+                    (property.name == "vertex_indices" || property.name == "vertex_index");
+
+                if (!is_face) {
+                    cursor += count * ply_type_size(property.type);
+                    continue;
+                }
+
+                uint32_t first = 0;
+                uint32_t previous = 0;
+
+                for (int corner = 0; corner < count; corner++) {
+                    uint32_t index = static_cast<uint32_t>(ply_read(cursor, property.type, swap));
+
+                    // Polygons are split into a fan around their first corner
+                    if (corner == 0) first = index;
+                    if (corner >= 2) mesh.indices.insert(mesh.indices.end(), { first, previous, index });
+
+                    previous = index;
+                }
+            }
+
+            if (is_vertex) {
+                mesh.positions.insert(mesh.positions.end(), values, values + 3);
+                if (has_normals) mesh.normals.insert(mesh.normals.end(), values + 3, values + 6);
+                if (has_uvs) mesh.uvs.insert(mesh.uvs.end(), values + 6, values + 8);
+            }
+        }
+    }
+
+    if (mesh.indices.empty()) {
+        std::cerr << "ERROR: '" << filename << "' has no triangles.\n";
+        return false;
+    }
+
+    uint32_t vertex_count = static_cast<uint32_t>(mesh.positions.size() / 3);
+
+    for (uint32_t index: mesh.indices) {
+        if (index >= vertex_count) {
+            std::cerr << "ERROR: Invalid face index in '" << filename << "'.\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Layout of a .rtm mesh file: this header, then 64 byte aligned sections of
+// positions, normals, uvs, indices and wide BVH nodes, all stored exactly as
+// TriangleMesh uses them in memory. Loading maps the file and points into it.
+struct MeshFileHeader {
+    char magic[8];            // "RTMESH" followed by zeros
+    uint32_t version;
+    uint32_t byte_order;      // mesh_file_byte_order as the writer saw it
+    uint32_t width;           // 4 or 8
+    uint32_t node_size;       // sizeof(WideBVHNode<width>) of the writer
+
+    uint64_t vertex_count;
+    uint64_t triangle_count;
+    uint64_t node_count;
+
+    // Byte offsets from the start of the file, 0 for missing attributes
+    uint64_t positions;
+    uint64_t normals;
+    uint64_t uvs;
+    uint64_t indices;
+    uint64_t nodes;
+
+    double bounds[6];         // Min x, y, z then max x, y, z
+};
+
+
+const char mesh_file_magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+const uint32_t mesh_file_version = 1;
+const uint32_t mesh_file_byte_order = 0x01020304;
+
+
+inline uint64_t mesh_file_align(uint64_t offset) {
+    return (offset + 63) & ~static_cast<uint64_t>(63);
+}
+
+
+bool save_mesh_file(const TriangleMesh &mesh, const std::string &filename) {
+    const WideBVHTree &tree = mesh.getTree();
+
+    uint64_t vertex_count = static_cast<uint64_t>(mesh.getVertexCount());
+    uint64_t triangle_count = static_cast<uint64_t>(mesh.getTriangleCount());
+    uint64_t node_count = static_cast<uint64_t>(tree.getNodeCount());
+
+    MeshFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, mesh_file_magic, sizeof(header.magic));
+
+    header.version = mesh_file_version;
+    header.byte_order = mesh_file_byte_order;
+    header.width = static_cast<uint32_t>(tree.getWidth());
+    header.node_size = static_cast<uint32_t>(tree.getNodeSize());
+
+    header.vertex_count = vertex_count;
+    header.triangle_count = triangle_count;
+    header.node_count = node_count;
+
+    // Sections in file order, each with its source and size in bytes
+    struct Section { uint64_t * offset; const void * data; uint64_t size; };
+
+    Section sections[] = {
+        { &header.positions, mesh.getPositions(), 3 * vertex_count * sizeof(float) },
+        { &header.normals, mesh.getNormals(), mesh.getNormals() ? 3 * vertex_count * sizeof(float) : 0 },
+        { &header.uvs, mesh.getUVs(), mesh.getUVs() ? 2 * vertex_count * sizeof(float) : 0 },
+        { &header.indices, mesh.getIndices(), 3 * triangle_count * sizeof(uint32_t) },
+        { &header.nodes, tree.getNodeData(), node_count * tree.getNodeSize() },
+    };
+
+    uint64_t offset = mesh_file_align(sizeof(MeshFileHeader));
+
+    for (Section &section: sections) {
+        if (section.size == 0) continue;
+
+        *section.offset = offset;
+        offset = mesh_file_align(offset + section.size);
+    }
+
+    AABB bounds = mesh.boundingBox();
+
+    for (int axis = 0; axis < 3; axis++) {
+        header.bounds[axis] = bounds.getMin()[axis];
+        header.bounds[axis + 3] = bounds.getMax()[axis];
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+
+    if (!file) {
+        std::cerr << "ERROR: Could not create '" << filename << "'.\n";
+        return false;
+    }
+
+    const char padding[64] = { 0 };
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    uint64_t written = sizeof(header);
+
+    for (Section &section: sections) {
+        if (section.size == 0) continue;
+
+        file.write(padding, static_cast<std::streamsize>(*section.offset - written));
+        file.write(static_cast<const char *>(section.data), static_cast<std::streamsize>(section.size));
+
+        written = *section.offset + section.size;
+    }
+
+    if (!file) {
+        std::cerr << "ERROR: Could not write '" << filename << "'.\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Walks the nodes of a mapped file once. Each lane must be a leaf inside the
+// triangles, an interior child stored after its parent, or the empty lane
+// the builder writes, with inverted bounds. Children after their parents
+// also rules out cycles, and depth is kept within the traversal stack.
+template <int W>
+bool mesh_file_nodes_valid(const char * data, int node_count, int triangle_count) {
+    const WideBVHNode<W> * nodes = reinterpret_cast<const WideBVHNode<W> *>(data);
+    std::vector<int> depths(node_count, 0);
+
+    float inf = std::numeric_limits<float>::infinity();
+
+    for (int i = 0; i < node_count; i++) {
+        const WideBVHNode<W> &node = nodes[i];
+
+        for (int lane = 0; lane < W; lane++) {
+            int child = node.child[lane];
+            int count = node.count[lane];
+
+            if (count > 0) {
+                if (child < 0 || child > triangle_count - count) return false;
+
+            } else if (count == 0 && child == -1) {
+                for (int axis = 0; axis < 3; axis++) {
+                    if (node.bounds[axis][lane] != inf || node.bounds[axis + 3][lane] != -inf) return false;
+                }
+
+            } else {
+                if (count != 0 || child <= i || child >= node_count) return false;
+
+                depths[child] = std::max(depths[child], depths[i] + 1);
+                if (depths[child] >= wide_max_depth) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Maps a .rtm file; nothing is parsed or copied, and nothing is built. The
+// indices and nodes are checked once, since hit and occluded trust them.
+TriangleMesh * load_mesh_file(const std::string &filename, const Material * material, Arena &arena) {
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->open(filename)) return nullptr;
+
+    const char * data = file->getData();
+    uint64_t size = file->getSize();
+
+    MeshFileHeader header;
+
+    if (size < sizeof(header)) {
+        std::cerr << "ERROR: '" << filename << "' is not a mesh file.\n";
+        return nullptr;
+    }
+
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, mesh_file_magic, sizeof(header.magic)) != 0 ||
+        header.version != mesh_file_version) {
+        std::cerr << "ERROR: '" << filename << "' is not a version " << mesh_file_version << " mesh file.\n";
+        return nullptr;
+    }
+
+    if (header.byte_order != mesh_file_byte_order) {
+        std::cerr << "ERROR: '" << filename << "' was written on a machine of the other byte order.\n";
+        return nullptr;
+    }
+
+    bool valid_width =
+        (header.width == 4 && header.node_size == sizeof(WideBVHNode<4>)) ||
+        (header.width == 8 && header.node_size == sizeof(WideBVHNode<8>));
+
+    if (!valid_width) {
+        std::cerr << "ERROR: '" << filename << "' has an unsupported BVH layout.\n";
+        return nullptr;
+    }
+
+    // Every section must be aligned and lie inside the file
+    auto section = [&](uint64_t offset, uint64_t bytes) {
+        return offset % 64 == 0 && offset <= size && bytes <= size - offset;
+    };
+
+    bool valid =
+        header.vertex_count <= 0x7fffffff && header.triangle_count <= 0x7fffffff && header.node_count <= 0x7fffffff &&
+        section(header.positions, 3 * header.vertex_count * sizeof(float)) &&
+        section(header.indices, 3 * header.triangle_count * sizeof(uint32_t)) &&
+        section(header.nodes, header.node_count * header.node_size) &&
+        (header.normals == 0 || section(header.normals, 3 * header.vertex_count * sizeof(float))) &&
+        (header.uvs == 0 || section(header.uvs, 2 * header.vertex_count * sizeof(float)));
+
+    if (!valid) {
+        std::cerr << "ERROR: '" << filename << "' is truncated or corrupt.\n";
+        return nullptr;
+    }
+
+    if (header.triangle_count == 0) {
+        std::cerr << "ERROR: '" << filename << "' has no triangles.\n";
+        return nullptr;
+    }
+
+    const uint32_t * indices = reinterpret_cast<const uint32_t *>(data + header.indices);
+
+    for (uint64_t i = 0; i < 3 * header.triangle_count; i++) {
+        if (indices[i] >= header.vertex_count) {
+            std::cerr << "ERROR: Invalid face index in '" << filename << "'.\n";
+            return nullptr;
+        }
+    }
+
+    int node_count = static_cast<int>(header.node_count);
+    int triangle_count = static_cast<int>(header.triangle_count);
+
+    bool valid_nodes = node_count > 0 && ((header.width == 8) ?
+        mesh_file_nodes_valid<8>(data + header.nodes, node_count, triangle_count) :
+        mesh_file_nodes_valid<4>(data + header.nodes, node_count, triangle_count));
+
+    if (!valid_nodes) {
+        std::cerr << "ERROR: '" << filename << "' has an invalid BVH.\n";
+        return nullptr;
+    }
+
+    AABB bounds = AABB(
+        point(header.bounds[0], header.bounds[1], header.bounds[2]),
+        point(header.bounds[3], header.bounds[4], header.bounds[5]));
+
+    return arena.create<TriangleMesh>(
+        file,
+        reinterpret_cast<const float *>(data + header.positions),
+        header.normals ? reinterpret_cast<const float *>(data + header.normals) : nullptr,
+        header.uvs ? reinterpret_cast<const float *>(data + header.uvs) : nullptr,
+        static_cast<int>(header.vertex_count),
+        indices,
+        triangle_count,
+        bounds,
+        static_cast<int>(header.width),
+        data + header.nodes,
+        node_count,
+        material);
+}
+
+
+// Picks the loader from the file extension. The mesh lives in arena.
+TriangleMesh * load_mesh(const std::string &filename, const Material * material, Arena &arena) {
+    MeshData mesh;
+    bool loaded = false;
+
+    std::string extension = filename.substr(filename.find_last_of('.') + 1);
+
+    if (extension == "rtm")
+        return load_mesh_file(filename, material, arena);
+
+    if (extension == "obj") {
+        loaded = load_obj(filename, mesh);
+
+    } else if (extension == "ply") {
+        loaded = load_ply(filename, mesh);
+
+    } else {
+        std::cerr << "ERROR: Unsupported mesh format '" << extension << "'.\n";
+    }
+
+    if (!loaded) return nullptr;
+
+    return arena.create<TriangleMesh>(
+        std::move(mesh.positions), std::move(mesh.normals),
+        std::move(mesh.uvs), std::move(mesh.indices), material);
+}
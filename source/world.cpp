@@ -1,5 +1,12 @@
+#include <map>
+
 #include "../rapidxml/rapidxml.hpp"
 
+#include "../headers/instance.hpp"
+#include "../headers/sphere_set.hpp"
+
+#include "mesh_loader.cpp"
+
 
 vector get_vector(rapidxml::xml_node<> * node) {
     return vector(
@@ -25,60 +32,197 @@ color get_color(rapidxml::xml_node<> * node) {
 }
 
 
-std::shared_ptr<Texture> get_texture(rapidxml::xml_node<> * node) {
+const Texture * get_texture(rapidxml::xml_node<> * node, Arena &arena) {
     std::string texture = node->first_attribute("texture")->value();
 
     if (texture == "solid") {
-        return std::make_shared<SolidTexture>(
+        return arena.create<SolidTexture>(
             get_color(node->first_node("albedo"))
         );
     }
 
     if (texture == "checker") {
-        return std::make_shared<CheckerTexture>(
+        return arena.create<CheckerTexture>(
             get_color(node->first_node("odd")),
             get_color(node->first_node("even"))
         );
     }
 
     if (texture == "image") {
-        return std::make_shared<ImageTexture>(
+        return arena.create<ImageTexture>(
             node->first_node("filename")->value()
         );
     }
 
-    return std::make_shared<SolidTexture>();
+    return arena.create<SolidTexture>();
 }
 
 
-std::shared_ptr<Material> get_material(rapidxml::xml_node<> * node) {
+const Material * get_material(rapidxml::xml_node<> * node, Arena &arena) {
     std::string appearance = node->first_attribute("appearance")->value();
 
-    std::shared_ptr<Texture> texture = get_texture(node);
+    const Texture * texture = get_texture(node, arena);
 
     if (appearance == "light")
-        return std::make_shared<LightSource>(texture);
+        return arena.create<LightSource>(texture);
 
     if (appearance == "lambertian")
-        return std::make_shared<Lambertian>(texture);
+        return arena.create<Lambertian>(texture);
 
     if (appearance == "metal") {
-        return std::make_shared<Metal>(
+        return arena.create<Metal>(
             texture, std::stod(node->first_node("fuzzy")->value())
         );
     }
 
     if (appearance == "dielectric") {
-        return std::make_shared<Dielectric>(
+        return arena.create<Dielectric>(
             texture, std::stod(node->first_node("refractive_index")->value())
         );
     }
 
-    return std::make_shared<Lambertian>();
+    return arena.create<Lambertian>();
+}
+
+
+Transform get_transform(rapidxml::xml_node<> * node) {
+    Transform transform;
+
+    // Scale first, then rotate around x, y and z, then translate
+    if (node->first_node("scale"))
+        transform = Transform::scaling(get_vector(node->first_node("scale"))) * transform;
+
+    if (node->first_node("rotate")) {
+        vector degrees = get_vector(node->first_node("rotate"));
+
+        for (int axis = 0; axis < 3; axis++)
+            transform = Transform::rotation(axis, degrees[axis]) * transform;
+    }
+
+    if (node->first_node("translate"))
+        transform = Transform::translation(get_vector(node->first_node("translate"))) * transform;
+
+    return transform;
+}
+
+
+using PrototypeMap = std::map<std::string, const Hittable *>;
+
+
+// Everything the object needs is created in arena
+const Hittable * get_object(rapidxml::xml_node<> * node, const PrototypeMap &prototypes, Arena &arena) {
+    std::string geometry = node->first_attribute("geometry")->value();
+
+    if (geometry == "instance") {
+        std::string name = node->first_attribute("prototype")->value();
+
+        auto prototype = prototypes.find(name);
+        if (prototype == prototypes.end()) {
+            std::cerr << "ERROR: Unknown prototype '" << name << "'.\n";
+            return nullptr;
+        }
+
+        // The material is optional and overrides the prototype's own
+        const Material * material = nullptr;
+        if (node->first_node("material"))
+            material = get_material(node->first_node("material"), arena);
+
+        return arena.create<Instance>(prototype->second, get_transform(node), material);
+    }
+
+    const Material * material = get_material(node->first_node("material"), arena);
+
+    if (geometry == "sphere") {
+        return arena.create<Sphere>(
+            get_point(node->first_node("center")),
+            std::stod(node->first_node("radius")->value()),
+            material
+        );
+    }
+
+    if (geometry == "plane") {
+        return arena.create<Plane>(
+            get_point(node->first_node("point")),
+            get_vector(node->first_node("normal")),
+            material
+        );
+    }
+
+    if (geometry == "quad") {
+        return arena.create<Quad>(
+            get_point(node->first_node("point")),
+            get_vector(node->first_node("vector_u")),
+            get_vector(node->first_node("vector_v")),
+            material
+        );
+    }
+
+    if (geometry == "mesh")
+        return load_mesh(node->first_node("filename")->value(), material, arena);
+
+    // Spheres without a material of their own take the one of the set
+    if (geometry == "sphere_set") {
+        std::vector<point> centers;
+        std::vector<double> radii;
+        std::vector<int> material_ids;
+        std::vector<const Material *> materials = { material };
+
+        for (rapidxml::xml_node<> * sphere = node->first_node("sphere"); sphere; sphere = sphere->next_sibling("sphere")) {
+            centers.push_back(get_point(sphere->first_node("center")));
+            radii.push_back(std::stod(sphere->first_node("radius")->value()));
+
+            if (sphere->first_node("material")) {
+                material_ids.push_back(static_cast<int>(materials.size()));
+                materials.push_back(get_material(sphere->first_node("material"), arena));
+
+            } else {
+                material_ids.push_back(0);
+            }
+        }
+
+        return arena.create<SphereSet>(centers, radii, material_ids, materials);
+    }
+
+    if (geometry == "box") {
+        return arena.create<Box>(
+            get_point(node->first_node("center")),
+            get_vector(node->first_node("sizes")),
+            material
+        );
+    }
+
+    return nullptr;
 }
 
 
-HittableList construct_world(std::string filename_xml) {
+// A prototype is built once into its own BVH, which every instance shares
+const Hittable * get_prototype(rapidxml::xml_node<> * node, const PrototypeMap &prototypes, Arena &arena) {
+    HittableList objects;
+
+    for (rapidxml::xml_node<> * child = node->first_node("object"); child; child = child->next_sibling("object")) {
+        const Hittable * object = get_object(child, prototypes, arena);
+        if (object) objects.add(object);
+    }
+
+    return arena.create<BVH>(objects);
+}
+
+
+// Emitters the camera aims shadow rays at. Planes are unbounded, and meshes
+// and instances still light the scene through the paths that hit them.
+bool is_light(rapidxml::xml_node<> * node, const Hittable &object) {
+    std::string geometry = node->first_attribute("geometry")->value();
+
+    if (geometry != "sphere" && geometry != "quad" && geometry != "box")
+        return false;
+
+    return object.getMaterial() && object.getMaterial()->isEmissive();
+}
+
+
+// The objects live in arena, which must outlive the list. Also fills lights
+// with the emitters that can be sampled directly.
+HittableList construct_world(std::string filename_xml, Arena &arena, HittableList &lights) {
     HittableList world;
 
     rapidxml::xml_document<> doc;
@@ -93,44 +237,26 @@ HittableList construct_world(std::string filename_xml) {
     doc.parse<0>(&buffer[0]);
 
     root = doc.first_node("scene");
-    for (node = root->first_node("object"); node; node = node->next_sibling()) {
-        std::string geometry = node->first_attribute("geometry")->value();
-
-        std::shared_ptr<Material> material = get_material(node->first_node("material"));
-
-        if (geometry == "sphere") {
-            world.add(std::make_shared<Sphere>(
-                get_point(node->first_node("center")),
-                std::stod(node->first_node("radius")->value()),
-                material
-            ));
-        }
 
-        if (geometry == "plane") {
-            world.add(std::make_shared<Plane>(
-                get_point(node->first_node("point")),
-                get_vector(node->first_node("normal")),
-                material
-            ));
-        }
+    // Prototypes may instance the ones declared before them
+    PrototypeMap prototypes;
+    for (node = root->first_node("prototype"); node; node = node->next_sibling("prototype"))
+        prototypes[node->first_attribute("name")->value()] = get_prototype(node, prototypes, arena);
 
-        if (geometry == "quad") {
-            world.add(std::make_shared<Quad>(
-                get_point(node->first_node("point")),
-                get_vector(node->first_node("vector_u")),
-                get_vector(node->first_node("vector_v")),
-                material
-            ));
-        }
+    for (node = root->first_node("object"); node; node = node->next_sibling("object")) {
+        const Hittable * object = get_object(node, prototypes, arena);
+        if (!object) continue;
 
-        if (geometry == "box") {
-            world.add(std::make_shared<Box>(
-                get_point(node->first_node("center")),
-                get_vector(node->first_node("sizes")),
-                material
-            ));
-        }
+        world.add(object);
+        if (is_light(node, *object)) lights.add(object);
     }
 
     return world;
 }
+
+
+HittableList construct_world(std::string filename_xml, Arena &arena) {
+    HittableList lights;
+
+    return construct_world(filename_xml, arena, lights);
+}
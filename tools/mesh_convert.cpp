@@ -0,0 +1,72 @@
+// Converts an OBJ or binary PLY mesh into a .rtm file, which the renderer maps
+// straight into memory with its BVH already built.
+//
+//     g++ -O2 -fopenmp tools/mesh_convert.cpp -o mesh_convert
+//     ./mesh_convert model.obj model.rtm [width]
+//
+// The width (4 or 8) of the stored BVH defaults to the widest one this CPU
+// supports; a width given is written as is, whatever the CPU. Files with 8
+// wide nodes still load on machines without AVX2.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../headers/color.hpp"
+#include "../headers/utils.hpp"
+
+#include "../source/mesh_loader.cpp"
+
+
+int main(int argc, char * argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.obj|input.ply> <output.rtm> [width]\n";
+        return 1;
+    }
+
+    std::string input = argv[1];
+    std::string output = argv[2];
+
+    int width = (argc > 3) ? std::stoi(argv[3]) : 0;
+
+    if (width != 0 && width != 4 && width != 8) {
+        std::cerr << "ERROR: The BVH width must be 4 or 8.\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    MeshData data;
+    std::string extension = input.substr(input.find_last_of('.') + 1);
+
+    bool loaded = false;
+
+    if (extension == "obj") loaded = load_obj(input, data);
+    else if (extension == "ply") loaded = load_ply(input, data);
+    else std::cerr << "ERROR: Unsupported mesh format '" << extension << "'.\n";
+
+    if (!loaded) return 1;
+
+    auto parsed = std::chrono::steady_clock::now();
+
+    TriangleMesh mesh = TriangleMesh(
+        std::move(data.positions), std::move(data.normals),
+        std::move(data.uvs), std::move(data.indices), nullptr, width);
+
+    auto built = std::chrono::steady_clock::now();
+
+    if (!save_mesh_file(mesh, output)) return 1;
+
+    auto saved = std::chrono::steady_clock::now();
+
+    auto ms = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    };
+
+    std::clog << mesh.getTriangleCount() << " triangles, " << mesh.getVertexCount() << " vertices, "
+              << mesh.getTree().getNodeCount() << " BVH" << mesh.getTree().getWidth() << " nodes\n"
+              << "parse " << ms(start, parsed) << " ms, build " << ms(parsed, built)
+              << " ms, write " << ms(built, saved) << " ms\n";
+
+    return 0;
+}